@@ -4,15 +4,59 @@
  */
 
 #include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <strings.h>
+#include <endian.h>
+#include <time.h>
+#include <math.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <signal.h>
+#ifdef HAVE_LIBPNG
+# include <png.h>
+#endif
+#ifdef HAVE_ZLIB
+# include <zlib.h>
+#endif
+#ifdef HAVE_GLES
+# include <EGL/egl.h>
+# include <EGL/eglext.h>
+# include <GLES3/gl31.h>
+#endif
 #include <gfxprim.h>
 
+#include "ca1d_rules.gen.h"
+
 /* If bit n is 1 then make all bits 1 otherwise 0 */
 #define BIT_TO_MAX(b, n) (((b >> n) & 1) * ~0UL)
 
 /* Number of bitfields in a row */
 static size_t width = 1;
+/* Cells used in the last bitfield of a row, from its most significant
+ * bit. The other bits are always zero.
+ */
+static unsigned int tail = 64;
+
+/* What the cells past either end of a row are */
+enum ca1d_boundary {
+	/* The row wraps around */
+	CA1D_BOUNDARY_PERIODIC,
+	CA1D_BOUNDARY_ZERO,
+	CA1D_BOUNDARY_ONE,
+	/* Each end cell is its own neighbour */
+	CA1D_BOUNDARY_REFLECT,
+};
+
+static enum ca1d_boundary boundary;
 /* Number of steps in the simulation */
 static size_t height = 64;
 /* Matrix of bitfields representing the automata's state over time */
@@ -21,6 +65,34 @@ static uint64_t *steps;
 static uint64_t *init;
 /* Zero row mask */
 static uint64_t *zeroes;
+/* The row before init in reversible mode, zero unless jumped ahead to */
+static uint64_t *init_prev;
+/* Running totals of each row's segment populations, for downsampling */
+static uint32_t *pops;
+/* Number of leading rows of pops which are up to date with steps */
+static size_t pops_rows;
+
+/* The segments [lo, hi) of a row, lo may be negative and hi past the
+ * width when the range wraps around. Empty when lo >= hi.
+ */
+struct ca1d_span {
+	ssize_t lo, hi;
+};
+
+/* Segments of each row which changed in the last update of steps */
+static struct ca1d_span *dirty;
+/* Initial conditions which steps were last evolved from */
+static uint64_t *steps_init;
+/* Number of leading steps which are up to date with steps_init and
+ * steps_key, zero when steps_init is stale too.
+ */
+static size_t steps_done;
+/* The GUI's initial conditions before it scrubbed through time, which
+ * are evolved forwards again to step back without reversible mode
+ */
+static uint64_t *gui_init;
+/* The new segments of a row before they are compared with the old */
+static uint64_t *scratch;
 /* The number of rules to alternate between */
 static uint8_t rule_n = 1;
 /* Numeric representation of the current update rules */
@@ -30,24 +102,133 @@ static int reversible;
 /* Meta update rule which changes the rule being used */
 static uint8_t meta_rule = 0;
 
+enum ca1d_rule_kind {
+	/* The radius one rules in rules */
+	CA1D_RULE_ELEMENTARY,
+	/* A rule number over all the cells within the radius */
+	CA1D_RULE_RADIUS,
+	/* A rule over the number of live cells within the radius */
+	CA1D_RULE_TOTALISTIC,
+	/* A rule over the center cell and the number of others live */
+	CA1D_RULE_OUTER_TOTALISTIC,
+};
+
+/* Up to 3 cells either side of the center */
+#define CA1D_MAX_RADIUS 3
+
+/* A single rule used instead of rules unless it is elementary */
+static struct ca1d_wide_rule {
+	enum ca1d_rule_kind kind;
+	unsigned int radius;
+	/* The rule number or code, least significant word first */
+	uint64_t number[2];
+	/* Bit i of number as a whole word, see ca1d_wide_rule_set */
+	uint64_t leaves[1 << (2 * CA1D_MAX_RADIUS + 1)];
+} wide_rule;
+/* Number of threads to divide each row between */
+static unsigned int threads = 1;
+/* Number of steps evolved per tile, 0 or 1 disables temporal blocking */
+static size_t tile_steps = 32;
+/* Only keep the rows needed to compute the next one */
+static int streaming;
+/* Evolve and render headless images on the GPU */
+static int gpu;
+
+/* Evolve a 2D grid of height rows instead of a row per step */
+static int ca2d;
+
+/* A Life-like rule, bit n of either is set for n live neighbours */
+struct ca2d_rule {
+	uint16_t born;
+	uint16_t survive;
+};
+
+/* B3/S23, Conway's Game of Life */
+static struct ca2d_rule ca2d_bs = { 1 << 3, 1 << 2 | 1 << 3 };
+/* The grid the next generation is written to, steps holds the current */
+static uint64_t *ca2d_back;
+/* The rows past the top and bottom of the grid for a live boundary */
+static uint64_t *ca2d_ones;
+/* Generations evolved since the grid was seeded */
+static uint64_t ca2d_generation;
+
 static gp_htable *uids;
 
-static void ca1d_allocate(void)
+#ifdef CA1D_STATS
+/* Counters of the work done by the engine and the GUI since they were
+ * last reset. The threads add to them with relaxed atomics once per
+ * range of segments, so they cost little even when enabled.
+ */
+struct ca1d_stats {
+	/* Segments evolved, including those redone by incremental updates */
+	uint64_t words;
+	/* Steps evolved */
+	uint64_t rows;
+	/* Segments the meta rule chose a rule for */
+	uint64_t meta_words;
+	/* Of those, the ones it gave another rule than the first */
+	uint64_t meta_switched;
+	/* Calls of ca1d_allocate */
+	uint64_t allocs;
+	/* Time spent evolving, shading the pixmap and redrawing the widget */
+	uint64_t sim_ns;
+	uint64_t shade_ns;
+	uint64_t redraw_ns;
+};
+
+static struct ca1d_stats ca1d_stats;
+
+static uint64_t ca1d_stats_ns(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+
+	return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+/* Read the counters, each is consistent but not with the others */
+static void ca1d_stats_get(struct ca1d_stats *out)
+{
+	/* All of the counters are uint64_t */
+	const uint64_t *src = (const uint64_t *)&ca1d_stats;
+	uint64_t *dst = (uint64_t *)out;
+	size_t i;
+
+	for (i = 0; i < sizeof(*out) / sizeof(uint64_t); i++)
+		dst[i] = __atomic_load_n(src + i, __ATOMIC_RELAXED);
+}
+
+/* Print the counters, and the rates per second of simulation time */
+static void ca1d_stats_print(FILE *f)
 {
-	if (init)
-		gp_vec_free(init);
-	init = gp_vec_new(width, sizeof(uint64_t));
-	init[width / 2] = 1UL << (63 - (width * 32) % 64);
+	struct ca1d_stats s;
+	double sim_s;
 
-	if (zeroes)
-		gp_vec_free(zeroes);
-	zeroes = gp_vec_new(width, sizeof(uint64_t));
+	ca1d_stats_get(&s);
+	sim_s = GP_MAX(s.sim_ns, 1ULL) / 1e9;
 
-	if (steps)
-		gp_vec_free(steps);
-	steps = gp_matrix_new(width, height, sizeof(uint64_t));
+	fprintf(f, "Words %lu, %.3g/s\n", (unsigned long)s.words, s.words / sim_s);
+	fprintf(f, "Rows %lu, %.3g/s\n", (unsigned long)s.rows, s.rows / sim_s);
+	fprintf(f, "Meta rule switched %lu of %lu segments\n",
+		(unsigned long)s.meta_switched, (unsigned long)s.meta_words);
+	fprintf(f, "Allocations %lu\n", (unsigned long)s.allocs);
+	fprintf(f, "Simulation time %.3fms shading %.3fms redraw %.3fms\n",
+		s.sim_ns / 1e6, s.shade_ns / 1e6, s.redraw_ns / 1e6);
 }
 
+# define CA1D_STAT_ADD(field, n) \
+	__atomic_fetch_add(&ca1d_stats.field, (n), __ATOMIC_RELAXED)
+/* Start timing with a stamp named t, CA1D_STAT_SINCE adds the time since */
+# define CA1D_STAT_STAMP(t) const uint64_t t = ca1d_stats_ns()
+# define CA1D_STAT_SINCE(field, t) CA1D_STAT_ADD(field, ca1d_stats_ns() - (t))
+#else
+/* The operands are not evaluated, but count as used */
+# define CA1D_STAT_ADD(field, n) do { (void)sizeof(n); } while (0)
+# define CA1D_STAT_STAMP(t) do { } while (0)
+# define CA1D_STAT_SINCE(field, t) do { } while (0)
+#endif
+
 /* Count the number of set bits using classic "Magic Numbers" algorithm.
  *
  * Binary Magic Numbers, by Edwin E. Freed; Dr. Dobbs Journal, April 1983
@@ -56,6 +237,9 @@ static void ca1d_allocate(void)
 __attribute__((const))
 static inline uint8_t pop_count(const uint64_t bit_field)
 {
+#ifdef __POPCNT__
+	return __builtin_popcountll(bit_field);
+#else
 	const uint64_t B[6] = {
 		0x5555555555555555,
 		0x3333333333333333,
@@ -71,63 +255,423 @@ static inline uint8_t pop_count(const uint64_t bit_field)
 		ret = ((ret >> (1 << i)) & B[i]) + (ret & B[i]);
 
 	return ret;
+#endif
 }
 
-/* Apply the current rule to a 64bit segment of a row */
-__attribute__((const))
-static inline uint64_t ca1d_rule_apply(const uint8_t rule,
+typedef uint64_t (*ca1d_rule_fn)(const uint64_t l,
+				 const uint64_t c,
+				 const uint64_t r);
+
+/* Apply a rule kernel to a 64bit segment of a row
+ *
+ * When fn is a compile time constant the kernel is inlined, otherwise
+ * this costs one indirect call per segment.
+ */
+static inline uint64_t ca1d_rule_apply(const ca1d_rule_fn fn,
 				       const uint64_t c_prev,
 				       const uint64_t c,
 				       const uint64_t c_next,
 				       const uint64_t c_prev_step)
 {
-	int i;
 	const uint64_t l = (c >> 1) ^ (c_prev << 63);
 	const uint64_t r = (c << 1) ^ (c_next >> 63);
-	uint64_t c_next_step = 0;
 
-	for (i = 0; i < 8; i++) {
-		const uint64_t active = BIT_TO_MAX(rule, i);
-		const uint64_t left   = BIT_TO_MAX(i, 2);
-		const uint64_t center = BIT_TO_MAX(i, 1);
-		const uint64_t right  = BIT_TO_MAX(i, 0);
+	return fn(l, c, r) ^ c_prev_step;
+}
 
-		c_next_step |=
-			active & ~(left ^ l) & ~(center ^ c) & ~(right ^ r);
+static inline size_t ca1d_cells(void)
+{
+	return 64 * (width - 1) + tail;
+}
+
+/* The cells used in the last bitfield of a row */
+static inline uint64_t ca1d_tail_mask(void)
+{
+	return ~0UL << (64 - tail);
+}
+
+/* Set the number of cells in a row, width and tail follow from it */
+static void ca1d_cells_set(const size_t cells)
+{
+	width = GP_MAX((size_t)1, (cells + 63) / 64);
+	tail = cells ? 64 - (64 * width - cells) : 64;
+}
+
+static inline uint64_t ca1d_rotl(const uint64_t a, const unsigned int n)
+{
+	return (a << n) | (a >> ((64 - n) & 63));
+}
+
+/* The segment of cells before the first one, from the boundary. Its
+ * least significant bit is the first cell's left neighbour, the rest
+ * only matter to the meta rule's majorities. Those are of the segment
+ * at the other end when the row wraps around, and of the first one when
+ * it is reflected, so that the ends only depend on their neighbours.
+ */
+static inline uint64_t ca1d_edge_left(const uint64_t *cur)
+{
+	switch (boundary) {
+	case CA1D_BOUNDARY_ZERO:
+		return 0;
+	case CA1D_BOUNDARY_ONE:
+		return ~0UL;
+	case CA1D_BOUNDARY_REFLECT:
+		return ca1d_rotl(cur[0], 1);
+	default:
+		return ca1d_rotl(cur[width - 1], tail % 64);
+	}
+}
+
+/* The segment of cells after the last one, its most significant bit is
+ * the last cell's right neighbour.
+ */
+static inline uint64_t ca1d_edge_right(const uint64_t *cur)
+{
+	switch (boundary) {
+	case CA1D_BOUNDARY_ZERO:
+		return 0;
+	case CA1D_BOUNDARY_ONE:
+		return ~0UL;
+	case CA1D_BOUNDARY_REFLECT:
+		return ca1d_rotl(cur[width - 1], tail - 1);
+	default:
+		return cur[0];
 	}
+}
+
+/* Apply a rule kernel to the last segment of a row
+ *
+ * When the row ends before the segment does, the right neighbour is
+ * put in the first unused bit so the rule sees it next to the last
+ * cell. What the rule makes of the unused bits is then masked off.
+ */
+static inline uint64_t ca1d_rule_apply_last(const ca1d_rule_fn fn,
+					    const uint64_t c_prev,
+					    uint64_t c,
+					    const uint64_t right,
+					    const uint64_t c_prev_step)
+{
+	if (tail < 64)
+		c |= (right >> 63) << (63 - tail);
 
-	return c_next_step ^ c_prev_step;
+	return ca1d_rule_apply(fn, c_prev, c, right, c_prev_step) & ca1d_tail_mask();
 }
 
-/* Apply the current rule to an entire row */
-static inline void ca1d_rule_apply_row(const uint64_t *prev,
-				       const uint64_t *cur,
-				       uint64_t *next)
+/* The neighbouring segments of segment i, from the boundary at the ends */
+static inline uint64_t ca1d_left_of(const uint64_t *cur, const size_t i)
+{
+	return i ? cur[i - 1] : ca1d_edge_left(cur);
+}
+
+static inline uint64_t ca1d_right_of(const uint64_t *cur, const size_t i)
+{
+	return i + 1 < width ? cur[i + 1] : ca1d_edge_right(cur);
+}
+
+/* Apply a rule kernel to segment i of a row, wherever it is */
+static inline uint64_t ca1d_rule_apply_at(const ca1d_rule_fn fn,
+					  const uint64_t *cur,
+					  const size_t i,
+					  const uint64_t c_prev_step)
+{
+	if (i + 1 < width)
+		return ca1d_rule_apply(fn, ca1d_left_of(cur, i), cur[i], cur[i + 1], c_prev_step);
+
+	return ca1d_rule_apply_last(fn, ca1d_left_of(cur, i), cur[i],
+				    ca1d_edge_right(cur), c_prev_step);
+}
+
+/* Apply a rule kernel to the segments [start, end) of a row
+ *
+ * Only the first and last segments of the row touch the boundary, so
+ * they are done separately to keep it out of the inner loop.
+ */
+static inline void ca1d_rule_apply_kernel_row(const ca1d_rule_fn fn,
+					      const uint64_t *prev,
+					      const uint64_t *cur,
+					      uint64_t *next,
+					      const size_t start,
+					      const size_t end)
+{
+	const size_t inner_end = GP_MIN(end, width - 1);
+	size_t i = start;
+
+	if (i >= end)
+		return;
+
+	if (!i) {
+		next[0] = ca1d_rule_apply_at(fn, cur, 0, prev[0]);
+		i = 1;
+	}
+
+	for (; i < inner_end; i++)
+		next[i] = ca1d_rule_apply(fn, cur[i - 1], cur[i], cur[i + 1], prev[i]);
+
+	if (i >= end)
+		return;
+
+	next[i] = ca1d_rule_apply_last(fn, cur[i - 1], cur[i], ca1d_edge_right(cur), prev[i]);
+}
+
+/* Each rule's minimal boolean formula as a segment kernel and a
+ * specialised row function, see ca1d_rules_gen.c.
+ */
+#define CA1D_RULE_KERNEL(n, ops, expr)					\
+__attribute__((const))							\
+static uint64_t ca1d_rule_##n(const uint64_t l,			\
+			      const uint64_t c,			\
+			      const uint64_t r)			\
+{									\
+	(void)l; (void)c; (void)r;					\
+									\
+	return expr;							\
+}									\
+									\
+static void ca1d_rule_##n##_row(const uint64_t *prev,			\
+				const uint64_t *cur,			\
+				uint64_t *next,				\
+				const size_t start,			\
+				const size_t end)			\
+{									\
+	ca1d_rule_apply_kernel_row(ca1d_rule_##n, prev, cur, next,	\
+				   start, end);				\
+}
+
+CA1D_RULES(CA1D_RULE_KERNEL)
+
+typedef void (*ca1d_row_fn)(const uint64_t *prev,
+			    const uint64_t *cur,
+			    uint64_t *next,
+			    const size_t start,
+			    const size_t end);
+
+#define CA1D_RULE_FN(n, ops, expr) ca1d_rule_##n,
+#define CA1D_RULE_ROW_FN(n, ops, expr) ca1d_rule_##n##_row,
+
+static const ca1d_rule_fn ca1d_rule_fns[256] = {
+	CA1D_RULES(CA1D_RULE_FN)
+};
+
+static const ca1d_row_fn ca1d_rule_row_fns[256] = {
+	CA1D_RULES(CA1D_RULE_ROW_FN)
+};
+
+/* Vectorised row functions process several segments per instruction.
+ *
+ * The neighbouring segments are fetched with unaligned loads offset by
+ * one word, so the carry between the lanes comes from the load rather
+ * than from shuffling registers. The first and last segments wrap
+ * around the row and are left to the scalar kernel along with any
+ * segments which don't fill a whole vector.
+ */
+typedef uint64_t ca1d_v128 __attribute__((vector_size(16)));
+#if defined(__x86_64__) || defined(__i386__)
+typedef uint64_t ca1d_v256 __attribute__((vector_size(32)));
+typedef uint64_t ca1d_v512 __attribute__((vector_size(64)));
+#endif
+
+#define CA1D_RULE_VEC_ROW(n, expr, vtype, isa, attr)			\
+attr static void ca1d_rule_##n##_row_##isa(const uint64_t *prev,	\
+					   const uint64_t *cur,	\
+					   uint64_t *next,		\
+					   const size_t start,		\
+					   const size_t end)		\
+{									\
+	const size_t vn = sizeof(vtype) / sizeof(uint64_t);		\
+	const size_t inner_end = GP_MIN(end, width - 1);		\
+	size_t i = GP_MAX(start, (size_t)1);				\
+									\
+	if (!start)							\
+		ca1d_rule_##n##_row(prev, cur, next, 0, 1);		\
+									\
+	for (; i + vn <= inner_end; i += vn) {				\
+		vtype c_prev, c, c_next, c_prev_step, res;		\
+									\
+		memcpy(&c_prev, cur + i - 1, sizeof(vtype));		\
+		memcpy(&c, cur + i, sizeof(vtype));			\
+		memcpy(&c_next, cur + i + 1, sizeof(vtype));		\
+		memcpy(&c_prev_step, prev + i, sizeof(vtype));		\
+									\
+		const vtype l = (c >> 1) ^ (c_prev << 63);		\
+		const vtype r = (c << 1) ^ (c_next >> 63);		\
+									\
+		(void)l; (void)r;					\
+		res = ((vtype){} | (expr)) ^ c_prev_step;		\
+		memcpy(next + i, &res, sizeof(vtype));			\
+	}								\
+									\
+	if (i < end)							\
+		ca1d_rule_##n##_row(prev, cur, next, i, end);		\
+}
+
+#define CA1D_RULE_V128_ROW(n, ops, expr) \
+	CA1D_RULE_VEC_ROW(n, expr, ca1d_v128, v128, )
+#define CA1D_RULE_V128_ROW_FN(n, ops, expr) ca1d_rule_##n##_row_v128,
+
+CA1D_RULES(CA1D_RULE_V128_ROW)
+
+static const ca1d_row_fn ca1d_rule_row_v128_fns[256] = {
+	CA1D_RULES(CA1D_RULE_V128_ROW_FN)
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+# define CA1D_RULE_AVX2_ROW(n, ops, expr) \
+	CA1D_RULE_VEC_ROW(n, expr, ca1d_v256, avx2, __attribute__((target("avx2"))))
+# define CA1D_RULE_AVX2_ROW_FN(n, ops, expr) ca1d_rule_##n##_row_avx2,
+# define CA1D_RULE_AVX512_ROW(n, ops, expr) \
+	CA1D_RULE_VEC_ROW(n, expr, ca1d_v512, avx512, __attribute__((target("avx512f"))))
+# define CA1D_RULE_AVX512_ROW_FN(n, ops, expr) ca1d_rule_##n##_row_avx512,
+
+CA1D_RULES(CA1D_RULE_AVX2_ROW)
+CA1D_RULES(CA1D_RULE_AVX512_ROW)
+
+static const ca1d_row_fn ca1d_rule_row_avx2_fns[256] = {
+	CA1D_RULES(CA1D_RULE_AVX2_ROW_FN)
+};
+
+static const ca1d_row_fn ca1d_rule_row_avx512_fns[256] = {
+	CA1D_RULES(CA1D_RULE_AVX512_ROW_FN)
+};
+
+static int ca1d_isa_avx2(void)
+{
+	return __builtin_cpu_supports("avx2");
+}
+
+static int ca1d_isa_avx512(void)
+{
+	return __builtin_cpu_supports("avx512f");
+}
+#endif
+
+static int ca1d_isa_any(void)
+{
+	return 1;
+}
+
+/* Collect whether the majority of cells are live in each of the n <= 64
+ * segments starting at cur, as bits from the most significant down.
+ *
+ * The meta rule reads this for each segment and both its neighbours,
+ * so it is done once per segment and per row rather than three times.
+ */
+#define CA1D_MAJORITIES(isa, attr, count)				\
+attr static uint64_t ca1d_majorities_##isa(const uint64_t *cur,	\
+					   const size_t n)		\
+{									\
+	uint64_t bits = 0;						\
+	size_t k;							\
+									\
+	for (k = 0; k < n; k++)						\
+		bits |= (uint64_t)(count(cur[k]) > 32) << (63 - k);	\
+									\
+	return bits;							\
+}
+
+CA1D_MAJORITIES(generic, , pop_count)
+
+#if defined(__x86_64__) || defined(__i386__)
+CA1D_MAJORITIES(popcnt, __attribute__((target("popcnt"))), __builtin_popcountll)
+CA1D_MAJORITIES(vpopcnt, __attribute__((target("avx512f,avx512vpopcntdq"))), __builtin_popcountll)
+
+static int ca1d_isa_popcnt(void)
+{
+	return __builtin_cpu_supports("popcnt");
+}
+
+static int ca1d_isa_vpopcnt(void)
+{
+	return __builtin_cpu_supports("avx512vpopcntdq");
+}
+#endif
+
+static const struct ca1d_popcnt_isa {
+	int (*supported)(void);
+	uint64_t (*majorities)(const uint64_t *cur, const size_t n);
+} ca1d_popcnt_isas[] = {
+#if defined(__x86_64__) || defined(__i386__)
+	{ca1d_isa_vpopcnt, ca1d_majorities_vpopcnt},
+	{ca1d_isa_popcnt, ca1d_majorities_popcnt},
+#endif
+	{ca1d_isa_any, ca1d_majorities_generic},
+};
+
+/* The majority bits function, NULL selects the per segment reference */
+static uint64_t (*ca1d_majorities)(const uint64_t *cur, const size_t n) =
+	ca1d_majorities_generic;
+
+/* Row function sets in order of preference */
+static const struct ca1d_isa {
+	const char *name;
+	int (*supported)(void);
+	const ca1d_row_fn *row_fns;
+} ca1d_isas[] = {
+#if defined(__x86_64__) || defined(__i386__)
+	{"avx512", ca1d_isa_avx512, ca1d_rule_row_avx512_fns},
+	{"avx2", ca1d_isa_avx2, ca1d_rule_row_avx2_fns},
+#endif
+	{"v128", ca1d_isa_any, ca1d_rule_row_v128_fns},
+	{"scalar", ca1d_isa_any, ca1d_rule_row_fns},
+};
+
+/* The row functions used for a single rule */
+static const ca1d_row_fn *ca1d_row_fns = ca1d_rule_row_fns;
+
+/* Select the named instruction set or the widest supported if NULL */
+static int ca1d_isa_select(const char *name)
 {
 	size_t i;
 
-	next[0] = ca1d_rule_apply(rules[0],
-				  cur[width - 1],
-				  cur[0],
-				  cur[GP_MIN((size_t)1, width - 1)],
-				  prev[0]);
+	for (i = 0; i < GP_ARRAY_SIZE(ca1d_isas); i++) {
+		const struct ca1d_isa *isa = &ca1d_isas[i];
+
+		if (name && strcmp(name, isa->name))
+			continue;
+
+		if (!isa->supported())
+			continue;
+
+		ca1d_row_fns = isa->row_fns;
+		ca1d_majorities = NULL;
+
+		if (isa->row_fns == ca1d_rule_row_fns)
+			return 0;
+
+		for (i = 0; i < GP_ARRAY_SIZE(ca1d_popcnt_isas); i++) {
+			if (ca1d_popcnt_isas[i].supported()) {
+				ca1d_majorities = ca1d_popcnt_isas[i].majorities;
+				break;
+			}
+		}
 
-	for (i = 1; i < width - 1; i++) {
-		next[i] = ca1d_rule_apply(rules[i % rule_n],
-					  cur[i - 1],
-					  cur[i],
-					  cur[i + 1],
-					  prev[i]);
+		return 0;
 	}
 
-	if (i >= width)
+	return 1;
+}
+
+/* Apply the current rules to the segments [start, end) of a row
+ *
+ * With a single rule the dispatch happens once for the whole range,
+ * alternating rules are looked up per segment.
+ */
+static inline void ca1d_rule_apply_row(const uint64_t *prev,
+				       const uint64_t *cur,
+				       uint64_t *next,
+				       const size_t start,
+				       const size_t end)
+{
+	size_t i;
+
+	if (rule_n == 1) {
+		ca1d_row_fns[rules[0]](prev, cur, next, start, end);
 		return;
+	}
 
-	next[i] = ca1d_rule_apply(rules[i % rule_n],
-				  cur[i - 1],
-				  cur[i],
-				  cur[0],
-				  prev[i]);
+	for (i = start; i < end; i++) {
+		next[i] = ca1d_rule_apply_at(ca1d_rule_fns[rules[i % rule_n]],
+					     cur, i, prev[i]);
+	}
 }
 
 static inline uint8_t ca1d_meta_rule_apply(const uint8_t rule,
@@ -154,398 +698,7624 @@ static inline uint8_t ca1d_meta_rule_apply(const uint8_t rule,
 	return rules[c_next_step];
 }
 
-static inline void ca1d_meta_rule_apply_row(const uint64_t *prev,
-					    const uint64_t *cur,
-					    uint64_t *next)
+/* Apply the meta rule to each segment in turn, this is the reference */
+static void ca1d_meta_rule_apply_row_ref(const uint64_t *prev,
+					 const uint64_t *cur,
+					 uint64_t *next,
+					 const size_t start,
+					 const size_t end)
 {
-	size_t i;
-	uint64_t c_prev = cur[width - 1],
-		c = cur[0],
-		c_next = cur[GP_MIN((size_t)1, width - 1)];
-	uint8_t rule = ca1d_meta_rule_apply(meta_rule, c_prev, c, c_next);
+	size_t i, switched = 0;
 
-	next[0] = ca1d_rule_apply(rule, c_prev, c, c_next, prev[0]);
+	for (i = start; i < end; i++) {
+		const uint8_t rule =
+			ca1d_meta_rule_apply(meta_rule, ca1d_left_of(cur, i),
+					     cur[i], ca1d_right_of(cur, i));
 
-	for (i = 1; i < width - 1; i++) {
-		c_prev = cur[i - 1];
-		c = cur[i];
-		c_next = cur[i + 1];
-
-		rule = ca1d_meta_rule_apply(meta_rule, c_prev, c, c_next);
-		next[i] = ca1d_rule_apply(rule, c_prev, c, c_next, prev[i]);
+		next[i] = ca1d_rule_apply_at(ca1d_rule_fns[rule], cur, i, prev[i]);
+		switched += rule != rules[0];
 	}
 
-	if (i >= width)
-		return;
-
-	c_prev = cur[i - 1];
-	c = cur[i];
-	c_next = cur[0];
-
-	rule = ca1d_meta_rule_apply(meta_rule, c_prev, c, c_next);
-	next[i] = ca1d_rule_apply(rule, c_prev, c, c_next, prev[i]);
+	CA1D_STAT_ADD(meta_words, end - start);
+	CA1D_STAT_ADD(meta_switched, switched);
 }
 
+/* Segments of majority bits collected at a time by the meta rule row */
+#define CA1D_META_CHUNK 1024
 
-static void ca1d_run(void)
+/* Apply the meta rule meta, choosing between rules r0 and r1, to 64
+ * segments at a time
+ *
+ * The meta rule is an elementary rule over the majority bits, so the
+ * same kernel which evolves the cells selects the rule for 64 segments
+ * at once. The majority bits of the segments either side of a chunk
+ * are its boundary.
+ */
+static void ca1d_meta_rules_apply_row(const uint8_t meta,
+				      const uint8_t r0,
+				      const uint8_t r1,
+				      const uint64_t *prev,
+				      const uint64_t *cur,
+				      uint64_t *next,
+				      const size_t start,
+				      const size_t end)
 {
-	const uint64_t *prev = zeroes;
-	const uint64_t *cur = steps;
-	uint64_t *next = steps + gp_matrix_idx(width, 1, 0);
-	size_t i = 1;
+	uint64_t (*const majorities)(const uint64_t *cur, const size_t n) =
+		ca1d_majorities ? ca1d_majorities : ca1d_majorities_generic;
+	const ca1d_rule_fn meta_fn = ca1d_rule_fns[meta];
+	const ca1d_rule_fn fns[2] = { ca1d_rule_fns[r0], ca1d_rule_fns[r1] };
+	uint64_t maj[CA1D_META_CHUNK / 64];
+	size_t s, b, k, switched = 0;
 
-	memcpy(steps, init, width * sizeof(uint64_t));
+	for (s = start; s < end; s += CA1D_META_CHUNK) {
+		const size_t n = GP_MIN(end - s, (size_t)CA1D_META_CHUNK);
+		const size_t blocks = (n + 63) / 64;
+		const uint64_t edges[2] = {
+			ca1d_left_of(cur, s), ca1d_right_of(cur, s + n - 1)
+		};
+		const uint64_t right = majorities(edges + 1, 1) >> 63;
+		uint64_t left = majorities(edges, 1) >> 63;
 
-	for (;;) {
-		if (meta_rule)
-			ca1d_meta_rule_apply_row(prev, cur, next);
-		else
-			ca1d_rule_apply_row(prev, cur, next);
+		for (b = 0; b < blocks; b++)
+			maj[b] = majorities(cur + s + 64 * b, GP_MIN((size_t)64, n - 64 * b));
 
-		if (++i >= height)
-			break;
+		for (b = 0; b < blocks; b++) {
+			const size_t bn = GP_MIN((size_t)64, n - 64 * b);
+			const uint64_t c = maj[b];
+			const uint64_t c_next = b + 1 < blocks ? maj[b + 1] >> 63 : right;
+			const uint64_t sel = meta_fn((c >> 1) | (left << 63), c,
+						     (c << 1) | (c_next << (64 - bn)));
+
+			switched += pop_count(sel >> (64 - bn));
+
+			for (k = 0; k < bn; k++) {
+				const size_t i = s + 64 * b + k;
+
+				next[i] = ca1d_rule_apply_at(fns[(sel >> (63 - k)) & 1],
+							     cur, i, prev[i]);
+			}
 
-		prev = reversible ? cur : zeroes;
-		cur = next;
-		next = steps + gp_matrix_idx(width, i, 0);
+			left = c & 1;
+		}
 	}
 
+	CA1D_STAT_ADD(meta_words, end - start);
+	CA1D_STAT_ADD(meta_switched, r0 != r1 ? switched : 0);
 }
 
-/* Note that i & 63 = i % 64 and i >> 6 = i / 64 as 2**6 = 64. Also
- * use putpixel_raw because it is inlined and we know x and y are
- * inside the pixmap.
- */
-static inline void shade_pixel(gp_pixmap *p,
-			       float pw, float ph,
-			       uint32_t x, uint32_t y,
-			       gp_pixel bg, gp_pixel fg)
+static void ca1d_meta_rule_apply_row(const uint64_t *prev,
+				     const uint64_t *cur,
+				     uint64_t *next,
+				     const size_t start,
+				     const size_t end)
 {
-	size_t i = (float)x * pw;
-	size_t j = (float)y * ph;
-	size_t k = 63 - (i & 63);
-	uint64_t c = steps[gp_matrix_idx(width, j, i >> 6)];
+	if (!ca1d_majorities) {
+		ca1d_meta_rule_apply_row_ref(prev, cur, next, start, end);
+		return;
+	}
 
-	c = BIT_TO_MAX(c, k);
-	gp_putpixel_raw(p, x, y, (fg & c) | (bg & ~c));
+	ca1d_meta_rules_apply_row(meta_rule, rules[0], rules[1],
+				  prev, cur, next, start, end);
 }
 
-static void fill_pixmap(gp_pixmap *p)
+/* Bits in the number of a wide rule of the kind and radius */
+static unsigned int ca1d_wide_rule_bits(const enum ca1d_rule_kind kind,
+					const unsigned int radius)
 {
-	uint32_t x, y;
-	gp_pixel bg = gp_rgb_to_pixmap_pixel(0xff, 0xff, 0xff, p);
-	gp_pixel fg = gp_rgb_to_pixmap_pixel(0x00, 0x00, 0x00, p);
-	gp_pixel fill = gp_rgb_to_pixmap_pixel(0xff, 0x00, 0x00, p);
-	uint64_t s, t;
-
-	s = gp_time_stamp();
-	gp_fill(p, fill);
-	t = gp_time_stamp();
-
-	printf("Fill time %lums\n", t - s);
-
-	s = gp_time_stamp();
-	ca1d_run();
-	t = gp_time_stamp();
+	switch (kind) {
+	case CA1D_RULE_TOTALISTIC:
+		return 2 * radius + 2;
+	case CA1D_RULE_OUTER_TOTALISTIC:
+		return 4 * radius + 2;
+	default:
+		return 1U << (2 * radius + 1);
+	}
+}
 
-	printf("Automata time %lums\n", t - s);
+/* Returns non-zero if the kind, radius and number are not a rule */
+static int ca1d_wide_rule_check(const unsigned int kind, const unsigned int radius,
+				const uint64_t number[2])
+{
+	unsigned int i;
 
-	if (width * 64 > p->w || height > p->h) {
-		printf("Automata is larger than screen\n");
-		return;
-	}
+	if (kind == CA1D_RULE_ELEMENTARY)
+		return 0;
 
-	float pw = (float)(64 * width) / (float)p->w;
-	float ph = (float)height / (float)p->h;
+	if (kind > CA1D_RULE_OUTER_TOTALISTIC || radius < 1 || radius > CA1D_MAX_RADIUS)
+		return 1;
 
-	s = gp_time_stamp();
-	for (y = 0; y < p->h; y++) {
-		for (x = 0; x < p->w; x++)
-			shade_pixel(p, pw, ph, x, y, bg, fg);
+	for (i = ca1d_wide_rule_bits(kind, radius); i < 128; i++) {
+		if ((number[i / 64] >> (i % 64)) & 1)
+			return 1;
 	}
-	t = gp_time_stamp();
 
-	printf("Fill rects time %lums\n", t - s);
+	return 0;
 }
 
-static void allocate_backing_pixmap(gp_widget_event *ev)
+/* Use the rule given by kind, radius and number instead of rules unless
+ * it is elementary. Returns non-zero if it is not valid.
+ */
+static int ca1d_wide_rule_set(const unsigned int kind, const unsigned int radius,
+			      const uint64_t number[2])
 {
-	gp_widget *w = ev->self;
-	gp_size l = w->w & 63 ? w->w + 64 - (w->w & 63) : w->w;
-	gp_size h = w->h;
+	unsigned int i;
 
-	gp_pixmap *new_pixmap = gp_pixmap_alloc(l, h, ev->ctx->pixel_type);
-	gp_pixmap_free(gp_widget_pixmap_set(w, new_pixmap));
-	fill_pixmap(new_pixmap);
-}
+	if (ca1d_wide_rule_check(kind, radius, number))
+		return 1;
 
-int pixmap_on_event(gp_widget_event *ev)
-{
-	gp_widget_event_dump(ev);
+	wide_rule.kind = kind;
+	if (kind == CA1D_RULE_ELEMENTARY)
+		return 0;
 
-	switch (ev->type) {
-	case GP_WIDGET_EVENT_RESIZE:
-		allocate_backing_pixmap(ev);
-	break;
-	default:
-	break;
-	}
+	wide_rule.radius = radius;
+	memcpy(wide_rule.number, number, sizeof(wide_rule.number));
+
+	for (i = 0; i < GP_ARRAY_SIZE(wide_rule.leaves); i++)
+		wide_rule.leaves[i] = -((number[i / 64] >> (i % 64)) & 1);
 
 	return 0;
 }
 
-static void pixmap_do_redraw(void)
+/* Whether cell x of a row is live, x may be past either end */
+static inline uint64_t ca1d_cell(const uint64_t *cur, ssize_t x)
 {
-	gp_widget *pixmap = gp_widget_by_uid(uids, "pixmap", GP_WIDGET_PIXMAP);
+	const ssize_t n = ca1d_cells();
+
+	if (x < 0 || x >= n) {
+		switch (boundary) {
+		case CA1D_BOUNDARY_ZERO:
+			return 0;
+		case CA1D_BOUNDARY_ONE:
+			return 1;
+		case CA1D_BOUNDARY_REFLECT:
+			x = x < 0 ? -1 - x : 2 * n - 1 - x;
+			break;
+		default:
+			break;
+		}
+
+		x = ((x % n) + n) % n;
+	}
 
-	fill_pixmap(gp_widget_pixmap_get(pixmap));
-	gp_widget_redraw(pixmap);
+	return (cur[x / 64] >> (63 - x % 64)) & 1;
 }
 
-static void parse_rule_nums(const char *const rules_str)
+/* The cells past a row's ends as segments, for the rules which reach
+ * more than one cell beyond the neighbouring segments
+ */
+struct ca1d_wide_edges {
+	/* Before the first segment, the least significant bit is next to it */
+	uint64_t before;
+	/* The last segment with the cells after it in its unused bits */
+	uint64_t last;
+	/* The cells after those */
+	uint64_t after;
+};
+
+static void ca1d_wide_edges_get(const uint64_t *cur, const unsigned int radius,
+				struct ca1d_wide_edges *e)
 {
-	const char *c = rules_str;
+	const ssize_t n = ca1d_cells();
+	unsigned int k;
+
+	e->before = 0;
+	e->last = cur[width - 1];
+	e->after = 0;
+
+	for (k = 0; k < radius; k++) {
+		const unsigned int pos = tail + k;
+		const uint64_t c = ca1d_cell(cur, n + k);
+
+		e->before |= ca1d_cell(cur, -1 - (ssize_t)k) << k;
+
+		if (pos < 64)
+			e->last |= c << (63 - pos);
+		else
+			e->after |= c << (127 - pos);
+	}
+}
+
+/* Add three bits in each lane, a full adder */
+static inline void ca1d_csa(uint64_t *carry, uint64_t *sum, const uint64_t a,
+			    const uint64_t b, const uint64_t c)
+{
+	const uint64_t u = a ^ b;
+
+	*carry = (a & b) | (u & c);
+	*sum = u ^ c;
+}
+
+/* Count the live cells of seven planes in each lane with a carry-save
+ * adder tree, into s from the most significant bit
+ */
+static inline void ca1d_count7(const uint64_t v[7], uint64_t s[3])
+{
+	uint64_t c0, s0, c1, s1, c2;
+
+	ca1d_csa(&c0, &s0, v[0], v[1], v[2]);
+	ca1d_csa(&c1, &s1, v[3], v[4], v[5]);
+	ca1d_csa(&c2, &s[2], s0, s1, v[6]);
+	ca1d_csa(&s[0], &s[1], c0, c1, c2);
+}
+
+/* Look up leaves[i] in each lane with a tree of multiplexers, where bit
+ * n - 1 - k of i is the lane's bit of v[k]
+ */
+static inline uint64_t ca1d_mux(const uint64_t *leaves, const uint64_t *v,
+				const unsigned int n)
+{
+	uint64_t m[1 << (2 * CA1D_MAX_RADIUS)];
+	unsigned int l;
+	size_t j;
+
+	for (j = 0; j < (1U << (n - 1)); j++)
+		m[j] = leaves[2 * j] ^ ((leaves[2 * j] ^ leaves[2 * j + 1]) & v[n - 1]);
+
+	for (l = n - 1; l--;) {
+		for (j = 0; j < (1U << l); j++)
+			m[j] = m[2 * j] ^ ((m[2 * j] ^ m[2 * j + 1]) & v[l]);
+	}
+
+	return m[0];
+}
+
+/* Apply a wide rule to a segment, like ca1d_rule_apply
+ *
+ * The cells within the radius are shifted into planes with the leftmost
+ * first. A rule number selects from all of them, a totalistic one from
+ * their count.
+ */
+static inline uint64_t ca1d_wide_apply(const struct ca1d_wide_rule *rule,
+				       const uint64_t c_prev,
+				       const uint64_t c,
+				       const uint64_t c_next)
+{
+	const unsigned int r = rule->radius;
+	uint64_t v[2 * CA1D_MAX_RADIUS + 1] = { 0 }, s[4];
+	unsigned int d;
+
+	v[r] = c;
+	for (d = 1; d <= r; d++) {
+		v[r - d] = (c >> d) | (c_prev << (64 - d));
+		v[r + d] = (c << d) | (c_next >> (64 - d));
+	}
+
+	switch (rule->kind) {
+	case CA1D_RULE_TOTALISTIC:
+		ca1d_count7(v, s);
+		return ca1d_mux(rule->leaves, s, 3);
+	case CA1D_RULE_OUTER_TOTALISTIC:
+		v[r] = 0;
+		ca1d_count7(v, s);
+		s[3] = c;
+		return ca1d_mux(rule->leaves, s, 4);
+	default:
+		return ca1d_mux(rule->leaves, v, 2 * r + 1);
+	}
+}
+
+/* Apply a wide rule to segment i, wherever it is in the row */
+static inline uint64_t ca1d_wide_apply_at(const struct ca1d_wide_rule *rule,
+					  const uint64_t *cur,
+					  const struct ca1d_wide_edges *e,
+					  const size_t i,
+					  const uint64_t c_prev_step)
+{
+	const uint64_t l = i ? cur[i - 1] : e->before;
+	const uint64_t c = i + 1 < width ? cur[i] : e->last;
+	const uint64_t r = i + 2 < width ? cur[i + 1] : i + 1 < width ? e->last : e->after;
+	const uint64_t next = ca1d_wide_apply(rule, l, c, r) ^ c_prev_step;
+
+	return i + 1 < width ? next : next & ca1d_tail_mask();
+}
+
+/* Apply the wide rule to the segments [start, end) of a row
+ *
+ * The last segment's unused bits are filled with the cells after the
+ * row, which the segment before it may also reach, so the first segment
+ * and the last two are done separately.
+ */
+static void ca1d_wide_apply_row(const uint64_t *prev,
+				const uint64_t *cur,
+				uint64_t *next,
+				const size_t start,
+				const size_t end)
+{
+	const struct ca1d_wide_rule *rule = &wide_rule;
+	const size_t inner_end = GP_MIN(end, width > 2 ? width - 2 : 0);
+	struct ca1d_wide_edges e;
+	size_t i = start;
+
+	if (i >= end)
+		return;
+
+	ca1d_wide_edges_get(cur, rule->radius, &e);
+
+	if (!i) {
+		next[0] = ca1d_wide_apply_at(rule, cur, &e, 0, prev[0]);
+		i = 1;
+	}
+
+	for (; i < inner_end; i++)
+		next[i] = ca1d_wide_apply(rule, cur[i - 1], cur[i], cur[i + 1]) ^ prev[i];
+
+	for (; i < end; i++)
+		next[i] = ca1d_wide_apply_at(rule, cur, &e, i, prev[i]);
+}
+
+static inline void ca1d_step_row(const uint64_t *prev,
+				 const uint64_t *cur,
+				 uint64_t *next,
+				 const size_t start,
+				 const size_t end)
+{
+	if (wide_rule.kind != CA1D_RULE_ELEMENTARY)
+		ca1d_wide_apply_row(prev, cur, next, start, end);
+	else if (meta_rule)
+		ca1d_meta_rule_apply_row(prev, cur, next, start, end);
+	else
+		ca1d_rule_apply_row(prev, cur, next, start, end);
+}
+
+/* Rules of up to 64 independent runs which are evolved bit-sliced
+ *
+ * A bit-sliced row holds one word per cell, with bit b of the word
+ * being the cell in run b. Each run may have its own rule.
+ */
+struct ca1d_sliced_rules {
+	/* Bit b of table[k] is bit k of run b's rule */
+	uint64_t table[8];
+	/* The runs which are reversible */
+	uint64_t reversible;
+};
+
+static void ca1d_sliced_rules_set(struct ca1d_sliced_rules *self,
+				  const unsigned int b,
+				  const uint8_t rule, const int rev)
+{
+	unsigned int k;
+
+	for (k = 0; k < 8; k++) {
+		self->table[k] &= ~(1ULL << b);
+		self->table[k] |= (uint64_t)((rule >> k) & 1) << b;
+	}
+
+	self->reversible &= ~(1ULL << b);
+	self->reversible |= (uint64_t)!!rev << b;
+}
+
+/* Evolve the cells of a bit-sliced row
+ *
+ * The rule of each run is looked up with a tree of multiplexers on the
+ * right, center and left cells. That takes 17 operations per cell for
+ * all of the runs, while a specialised kernel takes a handful for 64
+ * cells of one run. So this is not faster than evolving the runs one by
+ * one unless the rows are very narrow.
+ */
+static void ca1d_sliced_row(const struct ca1d_sliced_rules *self,
+			    const uint64_t *prev,
+			    const uint64_t *cur,
+			    uint64_t *next,
+			    const size_t cells)
+{
+	const uint64_t *t = self->table;
+	const uint64_t d0 = t[0] ^ t[1], d2 = t[2] ^ t[3];
+	const uint64_t d4 = t[4] ^ t[5], d6 = t[6] ^ t[7];
+	const uint64_t rev = self->reversible;
+	uint64_t left = cur[cells - 1], right = cur[0];
+	size_t x;
+
+	switch (boundary) {
+	case CA1D_BOUNDARY_ZERO:
+		left = right = 0;
+		break;
+	case CA1D_BOUNDARY_ONE:
+		left = right = ~0UL;
+		break;
+	case CA1D_BOUNDARY_REFLECT:
+		left = cur[0];
+		right = cur[cells - 1];
+		break;
+	default:
+		break;
+	}
+
+	for (x = 0; x < cells; x++) {
+		const uint64_t l = x ? cur[x - 1] : left;
+		const uint64_t c = cur[x];
+		const uint64_t r = x + 1 < cells ? cur[x + 1] : right;
+		const uint64_t m0 = t[0] ^ (d0 & r), m1 = t[2] ^ (d2 & r);
+		const uint64_t m2 = t[4] ^ (d4 & r), m3 = t[6] ^ (d6 & r);
+		const uint64_t n0 = m0 ^ ((m0 ^ m1) & c);
+		const uint64_t n1 = m2 ^ ((m2 ^ m3) & c);
+
+		next[x] = (n0 ^ ((n0 ^ n1) & l)) ^ (prev[x] & rev);
+	}
+}
+
+/* Transpose a 64x64 bit matrix in place, where bit 63 - j of a[i] is
+ * element (i, j).
+ *
+ * Hacker's Delight, 2nd ed., section 7-3.
+ */
+static void ca1d_transpose64(uint64_t a[64])
+{
+	uint64_t m = 0x00000000ffffffffULL, t;
+	unsigned int j, k;
+
+	for (j = 32; j; j >>= 1, m ^= m << j) {
+		for (k = 0; k < 64; k = (k + j + 1) & ~j) {
+			t = (a[k] ^ (a[k + j] >> j)) & m;
+			a[k] ^= t;
+			a[k + j] ^= t << j;
+		}
+	}
+}
+
+/* Bit-slice the rows of up to 64 runs, rows[b] is NULL for unused runs */
+static void ca1d_slice(const uint64_t *const rows[64], uint64_t *sliced)
+{
+	uint64_t a[64];
+	size_t i;
+	unsigned int b;
+
+	for (i = 0; i < width; i++) {
+		for (b = 0; b < 64; b++)
+			a[63 - b] = rows[b] ? rows[b][i] : 0;
+
+		ca1d_transpose64(a);
+		memcpy(sliced + 64 * i, a, sizeof(a));
+	}
+}
+
+/* Write the bit-sliced row back out as the rows of each run */
+static void ca1d_unslice(const uint64_t *sliced, uint64_t *const rows[64])
+{
+	uint64_t a[64];
+	size_t i;
+	unsigned int b;
+
+	for (i = 0; i < width; i++) {
+		memcpy(a, sliced + 64 * i, sizeof(a));
+		ca1d_transpose64(a);
+
+		for (b = 0; b < 64; b++) {
+			if (rows[b])
+				rows[b][i] = a[63 - b];
+		}
+	}
+}
+
+/* Iterations a thread busy waits before yielding the CPU */
+#define CA1D_SPIN_MAX 1024
+/* Smallest number of segments worth giving to a thread */
+#define CA1D_THREAD_MIN_WIDTH 8
+/* Slices start on a cache line to avoid false sharing at the edges */
+#define CA1D_THREAD_ALIGN 8
+
+static inline void ca1d_cpu_relax(unsigned int *spins)
+{
+	if (++(*spins) < CA1D_SPIN_MAX) {
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#endif
+		return;
+	}
+
+	*spins = 0;
+	sched_yield();
+}
+
+/* Sense reversing spin barrier
+ *
+ * The rows are only a few microseconds of work each, so sleeping on a
+ * mutex or futex between steps would cost more than the step itself.
+ */
+struct ca1d_barrier {
+	unsigned int n;
+	unsigned int count;
+	unsigned int sense;
+};
+
+static void ca1d_barrier_wait(struct ca1d_barrier *self, unsigned int *sense)
+{
+	unsigned int spins = 0;
+
+	*sense = !*sense;
+
+	if (__atomic_add_fetch(&self->count, 1, __ATOMIC_ACQ_REL) == self->n) {
+		__atomic_store_n(&self->count, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&self->sense, *sense, __ATOMIC_RELEASE);
+		return;
+	}
+
+	while (__atomic_load_n(&self->sense, __ATOMIC_ACQUIRE) != *sense)
+		ca1d_cpu_relax(&spins);
+}
+
+/* Consumer of finished rows
+ *
+ * The row is only valid for the duration of the call when streaming.
+ * Returning non-zero stops the simulation after the current step.
+ */
+struct ca1d_sink {
+	int (*row)(struct ca1d_sink *self, const uint64_t *row, size_t i);
+	/* Further sinks which are given the same rows */
+	struct ca1d_sink *next;
+	void *priv;
+};
+
+static int ca1d_sink_row(struct ca1d_sink *sink, const uint64_t *row,
+			 const size_t i)
+{
+	int ret = 0;
+
+	for (; sink; sink = sink->next)
+		ret |= sink->row(sink, row, i);
+
+	return ret;
+}
+
+/* State shared by the threads evolving the automaton */
+struct ca1d_job {
+	struct ca1d_barrier barrier;
+	struct ca1d_sink *sink;
+	/* First step to evolve, the ones before it are already done */
+	size_t from;
+	/* Set by the thread feeding the sink when it asks to stop */
+	size_t stop_at;
+	/* Set once the slices and barrier have been set up */
+	unsigned int go;
+};
+
+struct ca1d_worker {
+	pthread_t thread;
+	unsigned int id, n;
+	size_t start, end;
+	struct ca1d_job *job;
+};
+
+/* Segments per tile, eight rows of a tile fit in the L1 cache */
+#define CA1D_TILE_WIDTH 1024
+
+/* Number of rows stored in steps, less than height when streaming */
+static size_t step_rows;
+
+static inline uint64_t *ca1d_row(const size_t i)
+{
+	return steps + gp_matrix_idx(width, i % step_rows, 0);
+}
+
+/* The segments of each stored row which may not be zero, [lo, hi) */
+static struct ca1d_span *step_spans;
+
+/* The cells [lo, hi) which may be live in init, and init_prev in
+ * reversible mode. Only on when the rules leave a dead neighbourhood
+ * dead and the boundary is not live, so that a live cell's influence
+ * spreads one cell per step.
+ */
+static struct ca1d_active {
+	int on;
+	ssize_t lo, hi;
+} active;
+
+/* Cells a rule reaches either side of each cell */
+static inline unsigned int ca1d_radius(void)
+{
+	return wide_rule.kind == CA1D_RULE_ELEMENTARY ? 1 : wide_rule.radius;
+}
+
+/* Segments a change spreads to either side per step
+ *
+ * When the row wraps around and the last segment has fewer cells than
+ * the radius, the cells the segment before it reaches past the end are
+ * in the first segment.
+ */
+static inline unsigned int ca1d_spread(void)
+{
+	return 1 + (boundary == CA1D_BOUNDARY_PERIODIC && ca1d_radius() > tail);
+}
+
+/* The rules which are applied, the meta rule chooses between the first
+ * two whatever rule_n is
+ */
+static inline unsigned int ca1d_rules_used(void)
+{
+	return GP_MAX((unsigned int)rule_n, meta_rule ? 2U : 1U);
+}
+
+static void ca1d_active_set(void)
+{
+	const ssize_t w = width;
+	const unsigned int n = ca1d_rules_used();
+	ssize_t lo, hi;
+	uint64_t l, h;
+	unsigned int k;
+
+	active.on = boundary != CA1D_BOUNDARY_ONE;
+	for (k = 0; k < n; k++) {
+		if (rules[k] & 1)
+			active.on = 0;
+	}
+
+	if (wide_rule.kind != CA1D_RULE_ELEMENTARY)
+		active.on = boundary != CA1D_BOUNDARY_ONE && !(wide_rule.number[0] & 1);
+
+	for (lo = 0; lo < w && !init[lo] && !(reversible && init_prev[lo]); lo++)
+		;
+	for (hi = w; hi > lo && !init[hi - 1] && !(reversible && init_prev[hi - 1]); hi--)
+		;
+
+	if (lo >= hi) {
+		active.lo = active.hi = 0;
+		return;
+	}
+
+	l = init[lo] | (reversible ? init_prev[lo] : 0);
+	h = init[hi - 1] | (reversible ? init_prev[hi - 1] : 0);
+	active.lo = 64 * lo + __builtin_clzll(l);
+	active.hi = 64 * hi - __builtin_ctzll(h);
+}
+
+/* The segments of step i which may not be zero
+ *
+ * The bound is the light cone of init, once it wraps around the whole
+ * row is active.
+ */
+static inline struct ca1d_span ca1d_active_span(const size_t i)
+{
+	const ssize_t w = width;
+	const ssize_t lo = active.lo - (ssize_t)(i * ca1d_radius());
+	const ssize_t hi = active.hi + (ssize_t)(i * ca1d_radius());
+
+	if (!active.on || lo < 0 || hi > (ssize_t)ca1d_cells())
+		return (struct ca1d_span){ 0, w };
+
+	if (active.lo >= active.hi)
+		return (struct ca1d_span){ 0, 0 };
+
+	return (struct ca1d_span){ lo / 64, (hi + 63) / 64 };
+}
+
+static inline void ca1d_row_clear(uint64_t *row, const ssize_t lo, const ssize_t hi)
+{
+	if (lo < hi)
+		memset(row + lo, 0, (hi - lo) * sizeof(uint64_t));
+}
+
+/* Evolve the segments [start, end) within the active span a, the others
+ * are zeroed if fill is set and left alone otherwise
+ */
+static inline void ca1d_step_active(const uint64_t *prev,
+				    const uint64_t *cur,
+				    uint64_t *next,
+				    const struct ca1d_span a,
+				    const ssize_t start,
+				    const ssize_t end,
+				    const int fill)
+{
+	const ssize_t s = GP_MAX(start, a.lo);
+	const ssize_t e = GP_MIN(end, a.hi);
+
+	if (s >= e) {
+		if (fill)
+			ca1d_row_clear(next, start, end);
+		return;
+	}
+
+	if (fill) {
+		ca1d_row_clear(next, start, s);
+		ca1d_row_clear(next, e, end);
+	}
+
+	ca1d_step_row(prev, cur, next, s, e);
+	CA1D_STAT_ADD(words, e - s);
+}
+
+static void ca1d_step_span(const size_t i, uint64_t *next,
+			   ssize_t start, ssize_t end, const int fill)
+{
+	const ssize_t w = width;
+	const uint64_t *prev = !reversible ? zeroes : i > 1 ? ca1d_row(i - 2) : init_prev;
+	const uint64_t *cur = ca1d_row(i - 1);
+	const struct ca1d_span a = ca1d_active_span(i);
+
+	if (start < 0) {
+		ca1d_step_active(prev, cur, next, a, w + start, w, fill);
+		start = 0;
+	}
+
+	if (end > w) {
+		ca1d_step_active(prev, cur, next, a, 0, end - w, fill);
+		end = w;
+	}
+
+	if (start < end)
+		ca1d_step_active(prev, cur, next, a, start, end, fill);
+}
+
+/* Evolve the segments [start, end) of step i into next, the range may
+ * wrap around.
+ */
+static void ca1d_step_range_to(const size_t i, uint64_t *next,
+			       ssize_t start, ssize_t end)
+{
+	ca1d_step_span(i, next, start, end, 1);
+}
+
+/* Evolve the segments [start, end) of step i, the range may wrap around
+ *
+ * The segments outside the active span are skipped, ca1d_active_prepare
+ * has already zeroed them.
+ */
+static inline void ca1d_step_range(const size_t i, ssize_t start, ssize_t end)
+{
+	ca1d_step_span(i, ca1d_row(i), start, end, 0);
+}
+
+/* Record that segments a of step i may have been written */
+static void ca1d_step_spans_add(const size_t i, const struct ca1d_span a)
+{
+	struct ca1d_span *o = step_spans + i % step_rows;
+
+	if (a.lo >= a.hi)
+		return;
+
+	if (o->lo >= o->hi) {
+		*o = a;
+		return;
+	}
+
+	o->lo = GP_MIN(o->lo, a.lo);
+	o->hi = GP_MAX(o->hi, a.hi);
+}
+
+/* Zero what is left outside the active spans of the steps from onwards
+ *
+ * Each row of steps is zeroed outside the active span of the first step
+ * it will hold, the later steps stored in it only have wider spans.
+ */
+static void ca1d_active_prepare(const size_t from)
+{
+	size_t r;
+
+	for (r = 0; r < step_rows; r++) {
+		const size_t first = from + (r + step_rows - from % step_rows) % step_rows;
+		struct ca1d_span *o = step_spans + r;
+		uint64_t *row = steps + gp_matrix_idx(width, r, 0);
+		struct ca1d_span a;
+
+		if (first >= height)
+			continue;
+
+		a = ca1d_active_span(first);
+
+		if (a.lo >= a.hi) {
+			ca1d_row_clear(row, o->lo, o->hi);
+		} else {
+			ca1d_row_clear(row, o->lo, GP_MIN(o->hi, a.lo));
+			ca1d_row_clear(row, GP_MAX(o->lo, a.hi), o->hi);
+		}
+
+		*o = ca1d_active_span(first + (height - 1 - first) / step_rows * step_rows);
+	}
+}
+
+/* Whether the other threads have seen a stop request made before step i
+ *
+ * The request is made once every thread has finished step i - 1 and is
+ * made visible to all of them by the barrier at the end of step i.
+ */
+static inline int ca1d_job_stopped(struct ca1d_job *job, const size_t i)
+{
+	return i >= __atomic_load_n(&job->stop_at, __ATOMIC_RELAXED);
+}
+
+static inline void ca1d_job_stop(struct ca1d_job *job, const size_t i)
+{
+	__atomic_store_n(&job->stop_at, i, __ATOMIC_RELAXED);
+}
+
+/* Run the segments [start, end) of every step
+ *
+ * Each slice only reads its neighbours' edge segments from the
+ * previous row, so the threads need to sync once per step. The first
+ * thread feeds the finished rows to the sink while the others start
+ * on the next step, which is why a ring of three rows is enough.
+ */
+static void ca1d_run_slice(struct ca1d_worker *self)
+{
+	struct ca1d_job *job = self->job;
+	unsigned int sense = 0;
+	size_t i;
+
+	for (i = job->from; i < height; i++) {
+		ca1d_step_range(i, self->start, self->end);
+
+		if (self->n > 1)
+			ca1d_barrier_wait(&job->barrier, &sense);
+
+		if (ca1d_job_stopped(job, i))
+			break;
+
+		if (!self->id && ca1d_sink_row(job->sink, ca1d_row(i), i))
+			ca1d_job_stop(job, i + 1);
+	}
+}
+
+static inline int ca1d_tiled(void)
+{
+	return tile_steps > 1 && width >= 2 * CA1D_TILE_WIDTH && ca1d_spread() == 1;
+}
+
+static inline size_t ca1d_tile_depth(void)
+{
+	return GP_MIN(tile_steps, (size_t)CA1D_TILE_WIDTH / 2);
+}
+
+/* Rows which have to be kept when streaming
+ *
+ * A band of tiles reads two rows from the previous band, and the other
+ * threads write the next band while the first one consumes this one.
+ */
+static size_t ca1d_ring_rows(void)
+{
+	if (ca1d_tiled())
+		return 2 * ca1d_tile_depth() + 2;
+
+	return 3;
+}
+
+/* Evolve the automaton in bands of tile_steps rows using trapezoid tiles
+ *
+ * A tile computes all the steps in a band while its rows are still in
+ * the cache. The dependency cone grows by one segment per step, so
+ * first every tile computes the steps it can from the band's first row
+ * alone, narrowing by a segment on each side per step. Then the
+ * inverted trapezoids between the tiles fill in the rest from the
+ * neighbouring tiles' edges. Reversible mode reads the row two steps
+ * back, which is always in the same or an earlier trapezoid.
+ *
+ * Tiles within each phase are independent, so the threads only sync
+ * twice per band.
+ */
+static void ca1d_run_tiles(struct ca1d_worker *self)
+{
+	struct ca1d_job *job = self->job;
+	const ssize_t tiles = width / CA1D_TILE_WIDTH;
+	const size_t depth = ca1d_tile_depth();
+	const unsigned int id = self->id, n = self->n;
+	unsigned int sense = 0;
+	size_t r0, k;
+	ssize_t j;
+
+	for (r0 = job->from - 1; r0 + 1 < height; r0 += depth) {
+		const size_t d = GP_MIN(depth, height - 1 - r0);
+
+		for (j = id; j < tiles; j += n) {
+			const ssize_t a = width * j / tiles;
+			const ssize_t b = width * (j + 1) / tiles;
+
+			for (k = 1; k <= d; k++)
+				ca1d_step_range(r0 + k, a + k - 1, b - k + 1);
+		}
+
+		if (n > 1)
+			ca1d_barrier_wait(&job->barrier, &sense);
+
+		for (j = id; j < tiles; j += n) {
+			const ssize_t b = width * j / tiles;
+
+			for (k = 2; k <= d; k++)
+				ca1d_step_range(r0 + k, b - k + 1, b + k - 1);
+		}
+
+		if (n > 1)
+			ca1d_barrier_wait(&job->barrier, &sense);
+
+		if (ca1d_job_stopped(job, r0))
+			break;
+
+		if (id || !job->sink)
+			continue;
+
+		for (k = 1; k <= d; k++) {
+			if (ca1d_sink_row(job->sink, ca1d_row(r0 + k), r0 + k)) {
+				ca1d_job_stop(job, r0 + depth);
+				break;
+			}
+		}
+	}
+}
+
+static void ca1d_worker_run(struct ca1d_worker *self)
+{
+	if (ca1d_tiled())
+		ca1d_run_tiles(self);
+	else
+		ca1d_run_slice(self);
+}
+
+static void *ca1d_worker_main(void *arg)
+{
+	struct ca1d_worker *self = arg;
+	unsigned int spins = 0;
+
+	while (!__atomic_load_n(&self->job->go, __ATOMIC_ACQUIRE))
+		ca1d_cpu_relax(&spins);
+
+	ca1d_worker_run(self);
+
+	return NULL;
+}
+
+static size_t ca1d_slice_start(const unsigned int t, const unsigned int n)
+{
+	if (t >= n)
+		return width;
+
+	return (width * t / n) & ~(size_t)(CA1D_THREAD_ALIGN - 1);
+}
+
+/* Evolve the steps from the step from onwards, passing each row to sink
+ * if not NULL. The steps before from must already be done.
+ *
+ * Returns non-zero if the sink stopped the simulation early.
+ */
+static int ca1d_resume(struct ca1d_sink *sink, const size_t from)
+{
+	const unsigned int n = GP_MAX(1UL, GP_MIN(threads, width / CA1D_THREAD_MIN_WIDTH));
+	struct ca1d_worker workers[n];
+	struct ca1d_job job = {
+		.barrier = { .n = 1 },
+		.sink = sink,
+		.from = from,
+		.stop_at = SIZE_MAX,
+	};
+	unsigned int t, m;
+
+	ca1d_active_prepare(from);
+
+	for (m = 1; m < n; m++) {
+		workers[m].job = &job;
+
+		if (pthread_create(&workers[m].thread, NULL,
+				   ca1d_worker_main, &workers[m])) {
+			perror("pthread_create");
+			break;
+		}
+	}
+
+	job.barrier.n = m;
+	for (t = 0; t < m; t++) {
+		workers[t].id = t;
+		workers[t].n = m;
+		workers[t].start = ca1d_slice_start(t, m);
+		workers[t].end = ca1d_slice_start(t + 1, m);
+	}
+	workers[0].job = &job;
+
+	__atomic_store_n(&job.go, 1, __ATOMIC_RELEASE);
+
+	ca1d_worker_run(&workers[0]);
+
+	for (t = 1; t < m; t++)
+		pthread_join(workers[t].thread, NULL);
+
+	CA1D_STAT_ADD(rows, GP_MIN(job.stop_at, height) - from);
+
+	return job.stop_at != SIZE_MAX;
+}
+
+/* Evolve the automaton from init, passing each row to sink if not NULL
+ *
+ * Returns non-zero if the sink stopped the simulation early.
+ */
+static int ca1d_run(struct ca1d_sink *sink)
+{
+	ca1d_active_set();
+	memcpy(ca1d_row(0), init, width * sizeof(uint64_t));
+	ca1d_step_spans_add(0, (struct ca1d_span){ 0, width });
+	pops_rows = 0;
+
+	if (ca1d_sink_row(sink, ca1d_row(0), 0))
+		return 1;
+
+	return ca1d_resume(sink, 1);
+}
+
+/* Memory which buffers are carved from
+ *
+ * An arena only grows, geometrically, so changing the size a digit at a
+ * time or going back to an earlier size reuses memory which is already
+ * mapped and faulted in. Each buffer starts on a cache line.
+ */
+struct ca1d_arena {
+	uint8_t *base;
+	size_t size;
+	size_t used;
+};
+
+#define CA1D_ARENA_ALIGN 64
+/* Arenas at least this big are rounded up to and advised to use huge pages */
+#define CA1D_ARENA_HUGE (2UL << 20)
+
+/* Everything ca1d_allocate sizes by the width and height */
+static struct ca1d_arena rows_arena;
+/* The segment populations, only needed for downsampled pixmaps */
+static struct ca1d_arena pops_arena;
+
+static size_t ca1d_arena_round(const size_t size)
+{
+	return (size + CA1D_ARENA_ALIGN - 1) & ~(size_t)(CA1D_ARENA_ALIGN - 1);
+}
+
+/* Empty the arena and make sure it holds at least size bytes
+ *
+ * Returns 1 if it was replaced with new zeroed memory, 0 if the memory
+ * is reused as it is and -1, leaving it as it was, if it could not be
+ * grown.
+ */
+static int ca1d_arena_reset(struct ca1d_arena *self, size_t size)
+{
+	size_t page;
+	void *base;
+
+	if (size <= self->size) {
+		self->used = 0;
+		return 0;
+	}
+
+	size = GP_MAX(size, 2 * self->size);
+	page = size < CA1D_ARENA_HUGE ? (size_t)sysconf(_SC_PAGESIZE) : CA1D_ARENA_HUGE;
+	size = (size + page - 1) & ~(page - 1);
+
+	base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED)
+		return -1;
+
+#ifdef MADV_HUGEPAGE
+	if (size >= CA1D_ARENA_HUGE)
+		madvise(base, size, MADV_HUGEPAGE);
+#endif
+
+	if (self->base)
+		munmap(self->base, self->size);
+
+	self->base = base;
+	self->size = size;
+	self->used = 0;
+
+	return 1;
+}
+
+/* Take n elements from an arena reset to hold them */
+static void *ca1d_arena_take(struct ca1d_arena *self, const size_t n,
+			     const size_t elem)
+{
+	void *p = self->base + self->used;
+
+	self->used += ca1d_arena_round(n * elem);
+
+	return p;
+}
+
+/* Size the rows for the width and height
+ *
+ * Returns non-zero with errno set if they do not fit in memory, the rows
+ * of the last size are then left as they were.
+ */
+static int ca1d_allocate(void)
+{
+	const size_t row = ca1d_arena_round(width * sizeof(uint64_t));
+	/* Only replaces step_rows once the rows are allocated */
+	const size_t rows_n = streaming ? GP_MIN(height, ca1d_ring_rows()) : height;
+	size_t size, zeroed, i;
+	int fresh;
+
+	CA1D_STAT_ADD(allocs, 1);
+
+	if (rows_n > SIZE_MAX / 4 / row ||
+	    (ca2d && height > SIZE_MAX / 4 / row)) {
+		errno = ENOMEM;
+		return 1;
+	}
+
+	/* The steps and the 2D back grid are last and are not cleared when
+	 * the memory is reused, the spans of the steps say they may be live
+	 * so the light cone clears what it needs of them instead.
+	 */
+	zeroed = 3 * row + ca1d_arena_round(rows_n * sizeof(struct ca1d_span));
+	if (!streaming)
+		zeroed += ca1d_arena_round(height * sizeof(struct ca1d_span)) + 3 * row;
+	if (ca2d)
+		zeroed += row;
+
+	size = zeroed + ca1d_arena_round(width * rows_n * sizeof(uint64_t));
+	if (ca2d)
+		size += ca1d_arena_round(width * height * sizeof(uint64_t));
+
+	fresh = ca1d_arena_reset(&rows_arena, size);
+	if (fresh < 0)
+		return 1;
+
+	step_rows = rows_n;
+
+	if (!fresh)
+		memset(rows_arena.base, 0, zeroed);
+
+	init = ca1d_arena_take(&rows_arena, width, sizeof(uint64_t));
+	init[ca1d_cells() / 128] = 1UL << (63 - (ca1d_cells() / 2) % 64);
+	zeroes = ca1d_arena_take(&rows_arena, width, sizeof(uint64_t));
+	init_prev = ca1d_arena_take(&rows_arena, width, sizeof(uint64_t));
+	step_spans = ca1d_arena_take(&rows_arena, step_rows, sizeof(struct ca1d_span));
+
+	dirty = NULL;
+	steps_init = scratch = gui_init = NULL;
+	steps_done = 0;
+
+	if (!streaming) {
+		dirty = ca1d_arena_take(&rows_arena, height, sizeof(struct ca1d_span));
+		steps_init = ca1d_arena_take(&rows_arena, width, sizeof(uint64_t));
+		scratch = ca1d_arena_take(&rows_arena, width, sizeof(uint64_t));
+		gui_init = ca1d_arena_take(&rows_arena, width, sizeof(uint64_t));
+	}
+
+	ca2d_back = ca2d_ones = NULL;
+	ca2d_generation = 0;
+
+	if (ca2d) {
+		ca2d_ones = ca1d_arena_take(&rows_arena, width, sizeof(uint64_t));
+		memset(ca2d_ones, 0xff, width * sizeof(uint64_t));
+		ca2d_ones[width - 1] = ca1d_tail_mask();
+	}
+
+	steps = ca1d_arena_take(&rows_arena, width * step_rows, sizeof(uint64_t));
+	if (ca2d)
+		ca2d_back = ca1d_arena_take(&rows_arena, width * height, sizeof(uint64_t));
+
+	for (i = 0; !fresh && i < step_rows; i++)
+		step_spans[i] = (struct ca1d_span){ 0, width };
+
+	pops = NULL;
+	pops_rows = 0;
+
+	return 0;
+}
+
+/* Least rows of the grid given to each thread */
+#define CA2D_THREAD_MIN_ROWS 8
+
+/* Parse a Life-like rule such as B3/S23, either part may be empty */
+static int ca2d_rule_parse(const char *str, struct ca2d_rule *rule)
+{
+	struct ca2d_rule r = { 0, 0 };
+	uint16_t *set = NULL;
+	const char *c;
+
+	for (c = str; *c; c++) {
+		switch (*c) {
+		case 'B':
+		case 'b':
+			set = &r.born;
+			break;
+		case 'S':
+		case 's':
+			set = &r.survive;
+			break;
+		case '/':
+			set = NULL;
+			break;
+		case '0' ... '8':
+			if (!set)
+				return 1;
+
+			*set |= 1 << (*c - '0');
+			break;
+		default:
+			return 1;
+		}
+	}
+
+	*rule = r;
+
+	return 0;
+}
+
+static void ca2d_rule_str(const struct ca2d_rule *rule, char buf[24])
+{
+	char *c = buf;
+	unsigned int n;
+
+	*c++ = 'B';
+	for (n = 0; n <= 8; n++) {
+		if ((rule->born >> n) & 1)
+			*c++ = '0' + n;
+	}
+
+	*c++ = '/';
+	*c++ = 'S';
+	for (n = 0; n <= 8; n++) {
+		if ((rule->survive >> n) & 1)
+			*c++ = '0' + n;
+	}
+
+	*c = 0;
+}
+
+/* Count eight neighbour planes with full adders, the most significant
+ * bit of the count first
+ */
+static inline void ca2d_count8(const uint64_t v[8], uint64_t s[4])
+{
+	uint64_t c0, s0, c1, s1, c2, s2, c3, t, c4;
+
+	ca1d_csa(&c0, &s0, v[0], v[1], v[2]);
+	ca1d_csa(&c1, &s1, v[3], v[4], v[5]);
+	ca1d_csa(&c2, &s2, s0, s1, v[6]);
+	s[3] = s2 ^ v[7];
+	c3 = s2 & v[7];
+
+	ca1d_csa(&c4, &t, c0, c1, c2);
+	s[2] = t ^ c3;
+	c3 &= t;
+
+	s[1] = c4 ^ c3;
+	s[0] = c4 & c3;
+}
+
+/* The next state of the 64 cells c with the neighbour planes v */
+static inline uint64_t ca2d_apply(const struct ca2d_rule *rule,
+				  const uint64_t v[8], const uint64_t c)
+{
+	const unsigned int any = rule->born | rule->survive;
+	uint64_t s[4], next = 0;
+	unsigned int n;
+
+	ca2d_count8(v, s);
+
+	for (n = 0; n <= 8; n++) {
+		const uint64_t born = -(uint64_t)((rule->born >> n) & 1);
+		const uint64_t survive = -(uint64_t)((rule->survive >> n) & 1);
+		uint64_t eq;
+
+		if (!((any >> n) & 1))
+			continue;
+
+		eq = (n & 8 ? s[0] : ~s[0]) & (n & 4 ? s[1] : ~s[1]) &
+		     (n & 2 ? s[2] : ~s[2]) & (n & 1 ? s[3] : ~s[3]);
+		next |= eq & ((born & ~c) | (survive & c));
+	}
+
+	return next;
+}
+
+/* The planes of the cells west and east of each cell in segment i */
+static inline void ca2d_west_east(const uint64_t *row, const size_t i,
+				  uint64_t *west, uint64_t *east)
+{
+	uint64_t c = row[i], r = ca1d_right_of(row, i);
+
+	/* Put the right neighbour after the last cell, as in
+	 * ca1d_rule_apply_last
+	 */
+	if (i + 1 == width && tail < 64) {
+		c |= (r >> 63) << (63 - tail);
+		r = 0;
+	}
+
+	*west = (c >> 1) | (ca1d_left_of(row, i) << 63);
+	*east = (c << 1) | (r >> 63);
+}
+
+/* The row d rows below row j of the grid, from the boundary past the ends */
+static const uint64_t *ca2d_row_near(const uint64_t *grid, const size_t j,
+				     const int d)
+{
+	const size_t k = j + d;
+
+	if (k < height)
+		return grid + gp_matrix_idx(width, k, 0);
+
+	switch (boundary) {
+	case CA1D_BOUNDARY_ZERO:
+		return zeroes;
+	case CA1D_BOUNDARY_ONE:
+		return ca2d_ones;
+	case CA1D_BOUNDARY_REFLECT:
+		return grid + gp_matrix_idx(width, j, 0);
+	default:
+		return grid + gp_matrix_idx(width, d < 0 ? height - 1 : 0, 0);
+	}
+}
+
+/* Evolve row j of grid into next */
+static void ca2d_step_row(const struct ca2d_rule *rule, const uint64_t *grid,
+			  uint64_t *next, const size_t j)
+{
+	const uint64_t *const above = ca2d_row_near(grid, j, -1);
+	const uint64_t *const row = grid + gp_matrix_idx(width, j, 0);
+	const uint64_t *const below = ca2d_row_near(grid, j, 1);
+	uint64_t v[8];
+	size_t i;
+
+	for (i = 0; i < width; i++) {
+		ca2d_west_east(above, i, &v[0], &v[1]);
+		ca2d_west_east(row, i, &v[2], &v[3]);
+		ca2d_west_east(below, i, &v[4], &v[5]);
+		v[6] = above[i];
+		v[7] = below[i];
+
+		next[i] = ca2d_apply(rule, v, row[i]);
+	}
+
+	next[width - 1] &= ca1d_tail_mask();
+}
+
+/* State shared by the threads evolving the grid, like struct ca1d_job */
+struct ca2d_job {
+	struct ca1d_barrier barrier;
+	struct ca1d_sink *sink;
+	struct ca2d_rule rule;
+	/* The current grid and the one after it, swapped each generation */
+	uint64_t *grids[2];
+	uint64_t from, gens;
+	/* Generations evolved, set by the first thread when it is done */
+	uint64_t done;
+	/* Set by the thread feeding the sink when it asks to stop */
+	unsigned int stop;
+	unsigned int go;
+};
+
+struct ca2d_worker {
+	pthread_t thread;
+	unsigned int id;
+	/* The band of grid rows [start, end) this thread evolves */
+	size_t start, end;
+	struct ca2d_job *job;
+};
+
+/* Pass the rows of a generation to sink, they are numbered on from
+ * those of the generations before
+ */
+static int ca2d_sink_grid(struct ca1d_sink *sink, const uint64_t *grid,
+			  const uint64_t gen)
+{
+	int ret = 0;
+	size_t j;
+
+	for (j = 0; j < height; j++)
+		ret |= ca1d_sink_row(sink, grid + gp_matrix_idx(width, j, 0), gen * height + j);
+
+	return ret;
+}
+
+/* Evolve each generation in two grids, the sink is fed the one just done
+ * by the first thread while the others start on the next, which only
+ * writes to the grid before it
+ */
+static void ca2d_worker_run(struct ca2d_worker *self)
+{
+	struct ca2d_job *job = self->job;
+	unsigned int sense = 0;
+	uint64_t g;
+	size_t j;
+
+	for (g = 0; g < job->gens; g++) {
+		const uint64_t *grid = job->grids[g & 1];
+		uint64_t *next = job->grids[!(g & 1)];
+
+		for (j = self->start; j < self->end; j++)
+			ca2d_step_row(&job->rule, grid, next + gp_matrix_idx(width, j, 0), j);
+
+		CA1D_STAT_ADD(words, (self->end - self->start) * width);
+		ca1d_barrier_wait(&job->barrier, &sense);
+
+		if (__atomic_load_n(&job->stop, __ATOMIC_RELAXED)) {
+			g++;
+			break;
+		}
+
+		if (!self->id && job->sink &&
+		    ca2d_sink_grid(job->sink, next, job->from + g + 1))
+			__atomic_store_n(&job->stop, 1, __ATOMIC_RELAXED);
+	}
+
+	if (!self->id)
+		job->done = g;
+}
+
+static void *ca2d_worker_main(void *arg)
+{
+	struct ca2d_worker *self = arg;
+	unsigned int spins = 0;
+
+	while (!__atomic_load_n(&self->job->go, __ATOMIC_ACQUIRE))
+		ca1d_cpu_relax(&spins);
+
+	ca2d_worker_run(self);
+
+	return NULL;
+}
+
+/* Evolve the grid in steps by gens generations, passing the rows of each
+ * new generation to sink if not NULL. The grid is split into bands of
+ * rows between the threads.
+ *
+ * Returns non-zero if the sink stopped the simulation early.
+ */
+static int ca2d_evolve(const uint64_t gens, struct ca1d_sink *sink)
+{
+	const unsigned int n = GP_MAX(1UL, GP_MIN(threads, height / CA2D_THREAD_MIN_ROWS));
+	struct ca2d_worker workers[n];
+	struct ca2d_job job = {
+		.barrier = { .n = 1 },
+		.sink = sink,
+		.rule = ca2d_bs,
+		.grids = { steps, ca2d_back },
+		.from = ca2d_generation,
+		.gens = gens,
+	};
+	unsigned int t, m;
+
+	for (m = 1; m < n; m++) {
+		workers[m].job = &job;
+
+		if (pthread_create(&workers[m].thread, NULL,
+				   ca2d_worker_main, &workers[m])) {
+			perror("pthread_create");
+			break;
+		}
+	}
+
+	job.barrier.n = m;
+	for (t = 0; t < m; t++) {
+		workers[t].id = t;
+		workers[t].start = height * t / m;
+		workers[t].end = height * (t + 1) / m;
+	}
+	workers[0].job = &job;
+
+	__atomic_store_n(&job.go, 1, __ATOMIC_RELEASE);
+
+	ca2d_worker_run(&workers[0]);
+
+	for (t = 1; t < m; t++)
+		pthread_join(workers[t].thread, NULL);
+
+	if (job.done & 1) {
+		ca2d_back = steps;
+		steps = job.grids[1];
+	}
+
+	ca2d_generation += job.done;
+	pops_rows = 0;
+	CA1D_STAT_ADD(rows, job.done * height);
+
+	return job.stop;
+}
+
+/* Set cell x of row y of the grid, wrapping around small grids */
+static void ca2d_cell_set(const size_t x, const size_t y)
+{
+	const size_t cx = x % ca1d_cells();
+
+	steps[gp_matrix_idx(width, y % height, cx / 64)] |= 1UL << (63 - cx % 64);
+}
+
+/* Seed the grid with init as its middle row
+ *
+ * A lone live cell dies under any rule without B1, so when init is the
+ * default single middle cell an R-pentomino is put there instead.
+ */
+static void ca2d_seed(void)
+{
+	const size_t cells = ca1d_cells(), x = cells / 2, y = height / 2;
+	size_t i, pop = 0;
+
+	memset(steps, 0, width * height * sizeof(uint64_t));
+	ca2d_generation = 0;
+	pops_rows = 0;
+
+	for (i = 0; i < width; i++)
+		pop += pop_count(init[i]);
+
+	if (pop != 1 || init[cells / 128] != 1UL << (63 - x % 64)) {
+		memcpy(steps + gp_matrix_idx(width, y, 0), init, width * sizeof(uint64_t));
+		return;
+	}
+
+	ca2d_cell_set(x, y - 1);
+	ca2d_cell_set(x + 1, y - 1);
+	ca2d_cell_set(x - 1, y);
+	ca2d_cell_set(x, y);
+	ca2d_cell_set(x, y + 1);
+}
+
+/* Most states a cycle detector remembers, an entry is 16 bytes */
+#define CA1D_CYCLE_MAX_STATES (1UL << 22)
+
+struct ca1d_cycle_entry {
+	uint64_t hash;
+	/* One more than the step, zero marks an empty entry */
+	size_t step;
+};
+
+/* Finds the first state of a run which repeats from a hash of each row
+ *
+ * The state is the current row, and the previous one in reversible mode.
+ * States with the same hash are almost certainly the same, but the
+ * caller should still compare the rows if it has them.
+ */
+struct ca1d_cycle {
+	struct ca1d_cycle_entry *table;
+	size_t mask;
+	size_t used;
+	/* Hash of the previous row */
+	uint64_t row_hash;
+};
+
+static uint64_t ca1d_row_hash(const uint64_t *row)
+{
+	uint64_t h = 0x9e3779b97f4a7c15ULL;
+	size_t i;
+
+	for (i = 0; i < width; i++) {
+		h = (h ^ row[i]) * 0xff51afd7ed558ccdULL;
+		h ^= h >> 32;
+	}
+
+	return h;
+}
+
+static int ca1d_cycle_init(struct ca1d_cycle *self)
+{
+	self->mask = 1023;
+	self->used = 0;
+	self->table = calloc(self->mask + 1, sizeof(*self->table));
+
+	return !self->table;
+}
+
+static void ca1d_cycle_reset(struct ca1d_cycle *self)
+{
+	memset(self->table, 0, (self->mask + 1) * sizeof(*self->table));
+	self->used = 0;
+}
+
+static void ca1d_cycle_free(struct ca1d_cycle *self)
+{
+	free(self->table);
+	self->table = NULL;
+}
+
+static struct ca1d_cycle_entry *ca1d_cycle_find(struct ca1d_cycle_entry *table,
+						const size_t mask,
+						const uint64_t hash)
+{
+	size_t i = hash & mask;
+
+	while (table[i].step && table[i].hash != hash)
+		i = (i + 1) & mask;
+
+	return table + i;
+}
+
+static void ca1d_cycle_grow(struct ca1d_cycle *self)
+{
+	const size_t mask = 2 * self->mask + 1;
+	struct ca1d_cycle_entry *table = calloc(mask + 1, sizeof(*table));
+	size_t i;
+
+	if (!table)
+		return;
+
+	for (i = 0; i <= self->mask; i++) {
+		if (self->table[i].step)
+			*ca1d_cycle_find(table, mask, self->table[i].hash) = self->table[i];
+	}
+
+	free(self->table);
+	self->table = table;
+	self->mask = mask;
+}
+
+/* Add the state after step i, the steps must be added in order
+ *
+ * Returns an earlier step with the same state hash, or SIZE_MAX. Once
+ * the table is full new states are no longer added, but those already
+ * in it can still repeat.
+ */
+static size_t ca1d_cycle_step(struct ca1d_cycle *self, const uint64_t *row,
+			      const size_t i, const int rev)
+{
+	const uint64_t row_hash = ca1d_row_hash(row);
+	uint64_t hash = row_hash;
+	struct ca1d_cycle_entry *e;
+
+	if (rev) {
+		const uint64_t prev = i ? self->row_hash : ca1d_row_hash(init_prev);
+
+		hash ^= (prev << 29 | prev >> 35) * 0x9e3779b97f4a7c15ULL;
+		hash ^= hash >> 31;
+	}
+
+	self->row_hash = row_hash;
+	e = ca1d_cycle_find(self->table, self->mask, hash);
+
+	if (e->step)
+		return e->step - 1;
+
+	if (self->used >= CA1D_CYCLE_MAX_STATES || self->used >= self->mask)
+		return SIZE_MAX;
+
+	*e = (struct ca1d_cycle_entry){ hash, i + 1 };
+
+	if (++self->used * 2 > self->mask)
+		ca1d_cycle_grow(self);
+
+	return SIZE_MAX;
+}
+
+/* Nodes the memoised engine keeps before it starts afresh */
+#define CA1D_HL_MAX_NODES (1UL << 21)
+
+/* A canonical segment of 64 * 2**level cells of two consecutive rows
+ *
+ * Leaves are one segment of each row and the other nodes are the
+ * concatenation of two nodes of the level below. Nodes with the same
+ * cells are the same node, so a node's result is only computed once.
+ */
+struct ca1d_hl_node {
+	struct ca1d_hl_node *l, *r;
+	/* For leaves the previous, only used in reversible mode, and
+	 * current row's segment
+	 */
+	uint64_t prev, cur;
+	/* The middle half of the cells after 2**(level + 4) steps */
+	struct ca1d_hl_node *res;
+	struct ca1d_hl_node *chain;
+	unsigned int level;
+};
+
+/* Memoised engine which jumps ahead 2**j steps at a time
+ *
+ * This is Gosper's Hashlife in one dimension: the middle half of a
+ * node's cells after a quarter of its width in steps only depends on
+ * the node, so it is computed once from the results of five nodes of
+ * the level below and kept. Structured patterns made of a few distinct
+ * segments, or which repeat in time, are evolved in time logarithmic in
+ * the number of steps.
+ *
+ * The cells a node's result is made from are only relative to each
+ * other, so the rule can not depend on the segment's position in the
+ * row. That rules out a meta rule and alternating rules.
+ */
+struct ca1d_hl {
+	ca1d_rule_fn fn;
+	int reversible;
+	struct ca1d_hl_node **table;
+	size_t mask;
+	size_t nodes;
+	/* Nodes are allocated in blocks which are freed together */
+	struct ca1d_hl_block *blocks;
+	size_t block_used;
+	/* The nodes at each word of the row, for each level being built */
+	struct ca1d_hl_node **built;
+	unsigned int built_levels;
+};
+
+#define CA1D_HL_BLOCK_NODES 4096
+
+struct ca1d_hl_block {
+	struct ca1d_hl_block *next;
+	struct ca1d_hl_node nodes[CA1D_HL_BLOCK_NODES];
+};
+
+static void ca1d_hl_clear(struct ca1d_hl *self)
+{
+	struct ca1d_hl_block *b;
+
+	while ((b = self->blocks)) {
+		self->blocks = b->next;
+		free(b);
+	}
+
+	memset(self->table, 0, (self->mask + 1) * sizeof(*self->table));
+	self->nodes = 0;
+	self->block_used = CA1D_HL_BLOCK_NODES;
+}
+
+static int ca1d_hl_init(struct ca1d_hl *self)
+{
+	if (rule_n != 1 || meta_rule || wide_rule.kind != CA1D_RULE_ELEMENTARY ||
+	    tail != 64 || boundary != CA1D_BOUNDARY_PERIODIC)
+		return 1;
+
+	memset(self, 0, sizeof(*self));
+	self->fn = ca1d_rule_fns[rules[0]];
+	self->reversible = reversible;
+	self->mask = (1UL << 16) - 1;
+	self->table = calloc(self->mask + 1, sizeof(*self->table));
+	self->block_used = CA1D_HL_BLOCK_NODES;
+
+	return !self->table;
+}
+
+static void ca1d_hl_free(struct ca1d_hl *self)
+{
+	ca1d_hl_clear(self);
+	free(self->table);
+	free(self->built);
+}
+
+static uint64_t ca1d_hl_hash(const struct ca1d_hl_node *l,
+			     const struct ca1d_hl_node *r,
+			     const uint64_t prev, const uint64_t cur)
+{
+	uint64_t h = (uintptr_t)l * 0x9e3779b97f4a7c15ULL;
+
+	h = (h ^ (uintptr_t)r ^ (h >> 29)) * 0xbf58476d1ce4e5b9ULL;
+	h = (h ^ prev ^ (h >> 32)) * 0x94d049bb133111ebULL;
+	h = (h ^ cur ^ (h >> 29)) * 0xff51afd7ed558ccdULL;
+
+	return h ^ (h >> 32);
+}
+
+static void ca1d_hl_grow(struct ca1d_hl *self)
+{
+	const size_t mask = 2 * self->mask + 1;
+	struct ca1d_hl_node **table = calloc(mask + 1, sizeof(*table));
+	struct ca1d_hl_node *n, *next;
+	size_t i, h;
+
+	if (!table)
+		return;
+
+	for (i = 0; i <= self->mask; i++) {
+		for (n = self->table[i]; n; n = next) {
+			next = n->chain;
+			h = ca1d_hl_hash(n->l, n->r, n->prev, n->cur) & mask;
+			n->chain = table[h];
+			table[h] = n;
+		}
+	}
+
+	free(self->table);
+	self->table = table;
+	self->mask = mask;
+}
+
+/* Find or create the canonical node, l and r are NULL for a leaf */
+static struct ca1d_hl_node *ca1d_hl_node(struct ca1d_hl *self,
+					 struct ca1d_hl_node *l,
+					 struct ca1d_hl_node *r,
+					 const uint64_t prev, const uint64_t cur)
+{
+	size_t h = ca1d_hl_hash(l, r, prev, cur) & self->mask;
+	struct ca1d_hl_node *n;
+
+	for (n = self->table[h]; n; n = n->chain) {
+		if (n->l == l && n->r == r && n->prev == prev && n->cur == cur)
+			return n;
+	}
+
+	if (self->block_used == CA1D_HL_BLOCK_NODES) {
+		struct ca1d_hl_block *b = malloc(sizeof(*b));
+
+		if (!b)
+			return NULL;
+
+		b->next = self->blocks;
+		self->blocks = b;
+		self->block_used = 0;
+	}
+
+	n = self->blocks->nodes + self->block_used++;
+	*n = (struct ca1d_hl_node) {
+		.l = l,
+		.r = r,
+		.prev = prev,
+		.cur = cur,
+		.chain = self->table[h],
+		.level = l ? l->level + 1 : 0,
+	};
+	self->table[h] = n;
+
+	if (++self->nodes > self->mask)
+		ca1d_hl_grow(self);
+
+	return n;
+}
+
+static struct ca1d_hl_node *ca1d_hl_join(struct ca1d_hl *self,
+					 struct ca1d_hl_node *l,
+					 struct ca1d_hl_node *r)
+{
+	if (!l || !r)
+		return NULL;
+
+	return ca1d_hl_node(self, l, r, 0, 0);
+}
+
+/* Evolve the 128 cells of a level one node for 32 steps directly */
+static struct ca1d_hl_node *ca1d_hl_base(struct ca1d_hl *self,
+					 const struct ca1d_hl_node *n)
+{
+	uint64_t pa = n->l->prev, pb = n->r->prev;
+	uint64_t a = n->l->cur, b = n->r->cur;
+	int t;
+
+	for (t = 0; t < 32; t++) {
+		const uint64_t na = self->fn(a >> 1, a, a << 1 | b >> 63);
+		const uint64_t nb = self->fn(b >> 1 | a << 63, b, b << 1);
+
+		if (self->reversible) {
+			const uint64_t ca = a, cb = b;
+
+			a = na ^ pa;
+			b = nb ^ pb;
+			pa = ca;
+			pb = cb;
+		} else {
+			a = na;
+			b = nb;
+		}
+	}
+
+	return ca1d_hl_node(self, NULL, NULL,
+			    self->reversible ? pa << 32 | pb >> 32 : 0,
+			    a << 32 | b >> 32);
+}
+
+static struct ca1d_hl_node *ca1d_hl_result(struct ca1d_hl *self,
+					   struct ca1d_hl_node *n)
+{
+	struct ca1d_hl_node *a, *b, *c;
+
+	if (!n || n->res)
+		return n ? n->res : NULL;
+
+	if (n->level == 1) {
+		n->res = ca1d_hl_base(self, n);
+		return n->res;
+	}
+
+	/* The results of the left, middle and right halves are a quarter
+	 * of the steps along, their pairs give the rest of the steps.
+	 */
+	a = ca1d_hl_result(self, n->l);
+	b = ca1d_hl_result(self, ca1d_hl_join(self, n->l->r, n->r->l));
+	c = ca1d_hl_result(self, n->r);
+
+	n->res = ca1d_hl_join(self,
+			      ca1d_hl_result(self, ca1d_hl_join(self, a, b)),
+			      ca1d_hl_result(self, ca1d_hl_join(self, b, c)));
+
+	return n->res;
+}
+
+/* The node of level k starting at word s of the row, which wraps around */
+static struct ca1d_hl_node *ca1d_hl_build(struct ca1d_hl *self,
+					  const uint64_t *prev,
+					  const uint64_t *cur,
+					  const unsigned int k, const size_t s)
+{
+	struct ca1d_hl_node **n = self->built + k * width + s;
+
+	if (*n)
+		return *n;
+
+	if (!k) {
+		*n = ca1d_hl_node(self, NULL, NULL,
+				  self->reversible ? prev[s] : 0, cur[s]);
+	} else {
+		const size_t half = ((size_t)1 << (k - 1)) % width;
+
+		*n = ca1d_hl_join(self,
+				  ca1d_hl_build(self, prev, cur, k - 1, s),
+				  ca1d_hl_build(self, prev, cur, k - 1, (s + half) % width));
+	}
+
+	return *n;
+}
+
+/* Copy count words of a node starting at word skip */
+static void ca1d_hl_words(const struct ca1d_hl_node *n, size_t skip,
+			  size_t count, uint64_t *prev, uint64_t *cur)
+{
+	size_t half;
+
+	if (!n->level) {
+		*prev = n->prev;
+		*cur = n->cur;
+		return;
+	}
+
+	half = (size_t)1 << (n->level - 1);
+
+	if (skip < half) {
+		const size_t m = GP_MIN(count, half - skip);
+
+		ca1d_hl_words(n->l, skip, m, prev, cur);
+		prev += m;
+		cur += m;
+		count -= m;
+		skip = 0;
+	} else {
+		skip -= half;
+	}
+
+	if (count)
+		ca1d_hl_words(n->r, skip, count, prev, cur);
+}
+
+/* Evolve the rows prev and cur, 2**j steps with j at least 6 */
+static int ca1d_hl_jump(struct ca1d_hl *self, uint64_t *prev, uint64_t *cur,
+			const unsigned int j)
+{
+	const unsigned int k = j - 4;
+	const size_t half = (size_t)1 << (k - 1);
+	const size_t quarter = ((size_t)1 << (k - 2)) % width;
+	uint64_t *out = gp_vec_new(2 * width, sizeof(uint64_t));
+	size_t x;
+	int ret = 1;
+
+	if (!out)
+		return 1;
+
+	if (k + 1 > self->built_levels) {
+		free(self->built);
+		self->built = malloc((k + 1) * width * sizeof(*self->built));
+		self->built_levels = self->built ? k + 1 : 0;
+
+		if (!self->built)
+			goto out;
+	}
+
+	memset(self->built, 0, (k + 1) * width * sizeof(*self->built));
+
+	for (x = 0; x < width; x += half) {
+		const size_t s = (x + width - quarter) % width;
+		struct ca1d_hl_node *n;
+
+		/* Only the built nodes refer to others between results */
+		if (self->nodes > CA1D_HL_MAX_NODES) {
+			ca1d_hl_clear(self);
+			memset(self->built, 0, (k + 1) * width * sizeof(*self->built));
+		}
+
+		n = ca1d_hl_result(self, ca1d_hl_build(self, prev, cur, k, s));
+
+		if (!n)
+			goto out;
+
+		ca1d_hl_words(n, 0, GP_MIN(half, width - x), out + x, out + width + x);
+	}
+
+	memcpy(prev, out, width * sizeof(uint64_t));
+	memcpy(cur, out + width, width * sizeof(uint64_t));
+	ret = 0;
+out:
+	gp_vec_free(out);
+	return ret;
+}
+
+/* Evolve cur, and prev_row before it in reversible mode, by gen steps
+ *
+ * Swapping the rows of a reversible pair evolves it backwards instead.
+ * Returns non-zero if the rules can not be evolved this way or memory
+ * ran out, when the rows may have been partly evolved if the rules
+ * could.
+ */
+static int ca1d_hl_pair_advance(uint64_t *prev_row, uint64_t *cur, uint64_t gen)
+{
+	uint64_t *next = gp_vec_new(width, sizeof(uint64_t));
+	uint64_t *prev = gp_vec_new(width, sizeof(uint64_t));
+	struct ca1d_hl hl;
+	unsigned int j;
+	int ret = 1;
+
+	if (!next || !prev || ca1d_hl_init(&hl))
+		goto out;
+
+	memcpy(prev, reversible ? prev_row : zeroes, width * sizeof(uint64_t));
+
+	/* Steps too few for a jump are done by the dense kernel */
+	for (; gen & 63; gen--) {
+		ca1d_row_fns[rules[0]](reversible ? prev : zeroes, cur, next, 0, width);
+		memcpy(prev, cur, width * sizeof(uint64_t));
+		memcpy(cur, next, width * sizeof(uint64_t));
+	}
+
+	for (j = 6; gen; j++, gen >>= 1) {
+		if ((gen >> 6) & 1 && ca1d_hl_jump(&hl, prev, cur, j))
+			goto out_hl;
+	}
+
+	if (reversible)
+		memcpy(prev_row, prev, width * sizeof(uint64_t));
+	ret = 0;
+out_hl:
+	ca1d_hl_free(&hl);
+out:
+	if (next)
+		gp_vec_free(next);
+	if (prev)
+		gp_vec_free(prev);
+	return ret;
+}
+
+/* Evolve init, and init_prev in reversible mode, by gen steps */
+static int ca1d_hl_advance(const uint64_t gen)
+{
+	return ca1d_hl_pair_advance(init_prev, init, gen);
+}
+
+/* Move the pair of consecutive steps prev and cur by steps, backwards
+ * when it is negative
+ *
+ * As next = f(cur) ^ prev in reversible mode, prev = f(cur) ^ next too,
+ * so stepping back is stepping forwards with the pair swapped. Only the
+ * two rows are kept, however far they are moved. Without reversible
+ * mode prev is unused and the steps can only go forwards.
+ *
+ * Returns non-zero with errno set if the steps can not be taken.
+ */
+static int ca1d_pair_step(uint64_t *prev, uint64_t *cur, int64_t steps)
+{
+	const size_t row_bytes = width * sizeof(uint64_t);
+	uint64_t *a = steps < 0 ? cur : prev, *b = steps < 0 ? prev : cur;
+	uint64_t *next;
+	uint64_t n = steps < 0 ? -(uint64_t)steps : (uint64_t)steps;
+
+	if (steps < 0 && !reversible) {
+		errno = EINVAL;
+		return 1;
+	}
+
+	next = gp_vec_new(width, sizeof(uint64_t));
+	if (!next)
+		return 1;
+
+	for (; n; n--) {
+		ca1d_step_row(reversible ? a : zeroes, b, next, 0, width);
+		memcpy(a, b, row_bytes);
+		memcpy(b, next, row_bytes);
+		CA1D_STAT_ADD(words, width);
+	}
+
+	gp_vec_free(next);
+
+	return 0;
+}
+
+/* Note that i & 63 = i % 64 and i >> 6 = i / 64 as 2**6 = 64. Also
+ * use putpixel_raw because it is inlined and we know x and y are
+ * inside the pixmap.
+ */
+static inline void shade_pixel(gp_pixmap *p,
+			       float pw, float ph,
+			       uint32_t x, uint32_t y,
+			       gp_pixel bg, gp_pixel fg)
+{
+	size_t i = (float)x * pw;
+	size_t j = (float)y * ph;
+	size_t k = 63 - (i & 63);
+	uint64_t c = steps[gp_matrix_idx(width, j, i >> 6)];
+
+	c = BIT_TO_MAX(c, k);
+	gp_putpixel_raw(p, x, y, (fg & c) | (bg & ~c));
+}
+
+/* Each byte of cells widened to k bytes of pixels, for row_to_bits */
+static uint8_t *row_bits_expand;
+static unsigned int row_bits_k;
+
+/* Build the table row_to_bits needs for k pixels per cell
+ *
+ * It is shared by every thread shading rows, so it has to be built
+ * before they start. Returns non-zero if it could not be allocated.
+ */
+static int row_bits_prepare(const unsigned int k)
+{
+	unsigned int b, bit;
+	uint8_t *expand;
+
+	if (k == 1 || k == row_bits_k)
+		return 0;
+
+	expand = calloc(256, k);
+	if (!expand)
+		return 1;
+
+	for (b = 0; b < 256; b++) {
+		for (bit = 0; bit < 8 * k; bit++) {
+			if ((b >> (7 - bit / k)) & 1)
+				expand[b * k + bit / 8] |= 0x80 >> (bit & 7);
+		}
+	}
+
+	free(row_bits_expand);
+	row_bits_expand = expand;
+	row_bits_k = k;
+
+	return 0;
+}
+
+/* Write the first len bytes of a row as 1bit pixels with the leftmost
+ * in the most significant bit and each cell repeated k times, a set bit
+ * is a live cell.
+ *
+ * At 1:1 a segment already is the scanline in big endian byte order.
+ * Otherwise each byte of cells is widened to k bytes through the table
+ * row_bits_prepare built.
+ */
+static void row_to_bits(const uint64_t *row, uint8_t *line, const size_t len,
+			const unsigned int k)
+{
+	size_t i;
+
+	if (k == 1) {
+		uint64_t be;
+
+		for (i = 0; 8 * i + 8 <= len && i < width; i++) {
+			be = htobe64(row[i]);
+			memcpy(line + 8 * i, &be, sizeof(be));
+		}
+
+		if (8 * i < len && i < width) {
+			be = htobe64(row[i]);
+			memcpy(line + 8 * i, &be, len - 8 * i);
+		}
+		return;
+	}
+
+	for (i = 0; i < 8 * width && i * k < len; i++) {
+		const uint8_t b = row[i >> 3] >> (56 - 8 * (i & 7));
+
+		memcpy(line + i * k, row_bits_expand + b * k, GP_MIN((size_t)k, len - i * k));
+	}
+}
+
+/* Pixmap G1 pixels are either packed leftmost first from the most
+ * significant or from the least significant bit, find out which.
+ */
+static int g1_msb_first(void)
+{
+	static int ret = -1;
+	gp_pixmap *p;
+
+	if (ret >= 0)
+		return ret;
+
+	p = gp_pixmap_alloc(8, 1, GP_PIXEL_G1);
+	if (!p)
+		return 0;
+
+	gp_putpixel_raw(p, 0, 0, 1);
+	ret = p->pixels[0] == 0x80;
+	gp_pixmap_free(p);
+
+	return ret;
+}
+
+/* Write len bytes of a row as G1 pixels with each cell repeated k times */
+static void row_to_g1(const uint64_t *row, uint8_t *line, const size_t len,
+		      const unsigned int k, gp_pixel bg, gp_pixel fg)
+{
+	const uint8_t mask = (fg & 1) ? 0x00 : 0xff;
+	size_t i;
+
+	if ((fg & 1) == (bg & 1)) {
+		memset(line, (fg & 1) * 0xff, len);
+		return;
+	}
+
+	row_to_bits(row, line, len, k);
+
+	for (i = 0; i < len; i++)
+		line[i] ^= mask;
+
+	if (g1_msb_first())
+		return;
+
+	for (i = 0; i < len; i++) {
+		uint8_t b = line[i];
+
+		b = (b & 0xf0) >> 4 | (b & 0x0f) << 4;
+		b = (b & 0xcc) >> 2 | (b & 0x33) << 2;
+		b = (b & 0xaa) >> 1 | (b & 0x55) << 1;
+		line[i] = b;
+	}
+}
+
+static void render_g1_row(gp_pixmap *p, const uint64_t *row, uint8_t *line,
+			  const unsigned int k, gp_pixel bg, gp_pixel fg)
+{
+	row_to_g1(row, line, (p->w + 7) / 8, k, bg, fg);
+}
+
+/* Copy runs of fg or bg pixels from precomputed spans, one per cell
+ * state and each one segment of cells wide. Only the used cells of the
+ * last segment are copied.
+ */
+static void render_span_row(gp_pixmap *p, const uint64_t *row, uint8_t *line,
+			    const unsigned int k, const gp_pixmap *spans,
+			    const size_t start, const size_t end)
+{
+	const size_t bpp = gp_pixel_size(p->pixel_type) / 8;
+	const uint8_t *fg_span = spans->pixels;
+	const uint8_t *bg_span = spans->pixels + spans->bytes_per_row;
+	size_t i;
+
+	line += start * 64 * k * bpp;
+
+	for (i = start; i < end; i++) {
+		const unsigned int n = i + 1 < width ? 64 : tail;
+		uint64_t c = row[i];
+		unsigned int done = 0;
+
+		while (done < n) {
+			const int live = c >> 63;
+			const uint64_t rest = live ? ~c : c;
+			const unsigned int run = rest ? GP_MIN((unsigned int)__builtin_clzll(rest), n - done) : n - done;
+			const size_t len = (size_t)run * k * bpp;
+
+			memcpy(line, live ? fg_span : bg_span, len);
+			line += len;
+			done += run;
+			c = run < 64 ? c << run : 0;
+		}
+	}
+}
+
+/* Find the segments [*start, *end) of the rows [j0, j1) which changed in
+ * the last update, or all of them if full is set. Returns zero if none
+ * did. A range which wraps around the row is widened to the whole row.
+ */
+static int rows_dirty(const size_t j0, const size_t j1, const int full,
+		      size_t *start, size_t *end)
+{
+	const ssize_t w = width;
+	ssize_t lo = w, hi = 0;
+	size_t j;
+
+	*start = 0;
+	*end = width;
+
+	if (full || !dirty)
+		return 1;
+
+	for (j = j0; j < j1; j++) {
+		const ssize_t off = dirty[j].lo - ((dirty[j].lo % w) + w) % w;
+		const ssize_t l = dirty[j].lo - off, h = dirty[j].hi - off;
+
+		if (l >= h)
+			continue;
+
+		if (h > w)
+			return 1;
+
+		lo = GP_MIN(lo, l);
+		hi = GP_MAX(hi, h);
+	}
+
+	if (lo >= hi)
+		return 0;
+
+	*start = lo;
+	*end = hi;
+
+	return 1;
+}
+
+/* Shade the pixmap rows [y0, y1) from the steps matrix, only where the
+ * steps changed in the last update unless full is set.
+ *
+ * When a whole number of pixels covers each cell horizontally the
+ * scanlines are built word by word, otherwise each pixel is sampled
+ * with shade_pixel. Vertically consecutive scanlines showing the same
+ * row are copied.
+ */
+static void render_pixmap(gp_pixmap *p, float pw, float ph,
+			  gp_pixel bg, gp_pixel fg, const int full,
+			  const uint32_t y0, const uint32_t y1)
+{
+	const size_t cells = ca1d_cells();
+	const unsigned int k = p->w % cells ? 0 : p->w / cells;
+	const unsigned int bits = gp_pixel_size(p->pixel_type);
+	gp_pixmap *spans = NULL;
+	size_t prev_j = SIZE_MAX, start, end;
+	uint32_t x, y;
+
+	if (k && bits >= 8 && !(bits & 7)) {
+		spans = gp_pixmap_alloc(64 * k, 2, p->pixel_type);
+
+		if (spans) {
+			gp_fill_rect_xywh(spans, 0, 0, 64 * k, 1, fg);
+			gp_fill_rect_xywh(spans, 0, 1, 64 * k, 1, bg);
+		}
+	}
+
+	if (p->offset || !(spans || (k && p->pixel_type == GP_PIXEL_G1 &&
+				     !row_bits_prepare(k)))) {
+		for (y = y0; y < y1; y++) {
+			const size_t j = (float)y * ph;
+			uint32_t x1;
+
+			if (!rows_dirty(j, j + 1, full, &start, &end))
+				continue;
+
+			x = (float)(64 * start) / pw;
+			x1 = GP_MIN(p->w, (uint32_t)((float)(64 * end) / pw) + 1);
+
+			for (; x < x1; x++)
+				shade_pixel(p, pw, ph, x, y, bg, fg);
+		}
+		goto out;
+	}
+
+	for (y = y0; y < y1; y++) {
+		const size_t j = (float)y * ph;
+		uint8_t *line = p->pixels + (size_t)y * p->bytes_per_row;
+		const uint64_t *row = steps + gp_matrix_idx(width, j, 0);
+
+		if (j == prev_j) {
+			memcpy(line, line - p->bytes_per_row, p->bytes_per_row);
+			continue;
+		}
+
+		if (!rows_dirty(j, j + 1, full, &start, &end))
+			continue;
+
+		if (spans)
+			render_span_row(p, row, line, k, spans, start, end);
+		else
+			render_g1_row(p, row, line, k, bg, fg);
+
+		prev_j = j;
+	}
+
+out:
+	gp_pixmap_free(spans);
+}
+
+/* Running totals of the segment populations of row, pop[i] is the live
+ * cells in the segments up to and including i
+ */
+static void row_pops(const uint64_t *row, uint32_t *pop)
+{
+	uint32_t acc = 0;
+	size_t i;
+
+	for (i = 0; i < width; i++) {
+		acc += pop_count(row[i]);
+		pop[i] = acc;
+	}
+}
+
+static void pops_row(const size_t j)
+{
+	row_pops(steps + gp_matrix_idx(width, j, 0), pops + gp_matrix_idx(width, j, 0));
+}
+
+/* Compute the running totals of the segment populations for the first
+ * rows
+ *
+ * This is done once per simulation, after which any other zoom level
+ * only reads the totals and the partially covered segments.
+ */
+static int pops_update(const size_t rows)
+{
+	if (!pops) {
+		if (ca1d_arena_reset(&pops_arena, width * height * sizeof(uint32_t)) < 0)
+			return 1;
+
+		pops = ca1d_arena_take(&pops_arena, width * height, sizeof(uint32_t));
+	}
+
+	for (; pops_rows < rows; pops_rows++)
+		pops_row(pops_rows);
+
+	return 0;
+}
+
+/* Number of live cells in [c0, c1) of row, given its running totals,
+ * the cells are the bits of a segment from most to least significant.
+ */
+static uint64_t cells_pop(const uint64_t *row, const uint32_t *pop,
+			  const size_t c0, const size_t c1)
+{
+	const size_t w0 = c0 >> 6, w1 = c1 >> 6;
+	const uint64_t head = ~0UL >> (c0 & 63);
+	const uint64_t tail = ~(~0UL >> (c1 & 63));
+	uint64_t n;
+
+	if (w0 == w1)
+		return pop_count(row[w0] & head & tail);
+
+	n = pop_count(row[w0] & head) + pop[w1 - 1] - pop[w0];
+
+	if (tail)
+		n += pop_count(row[w1] & tail);
+
+	return n;
+}
+
+/* Number of live cells in [c0, c1) of row j */
+static uint64_t row_cells_pop(const size_t j, const size_t c0, const size_t c1)
+{
+	return cells_pop(steps + gp_matrix_idx(width, j, 0),
+			 pops + gp_matrix_idx(width, j, 0), c0, c1);
+}
+
+/* End of the steps shaded into row y of a downsampled pixmap */
+static inline size_t density_rows_end(const gp_pixmap *p, const uint32_t y)
+{
+	const size_t j0 = (uint64_t)y * height / p->h;
+
+	return GP_MAX(j0 + 1, (uint64_t)(y + 1) * height / p->h);
+}
+
+/* Shade each pixel by the fraction of live cells in the block it covers
+ *
+ * Used when there are more cells than pixels in either direction. A
+ * block is at least one cell, so it also stretches the other direction.
+ * Only the blocks which changed in the last update are shaded unless
+ * full is set, and only in the pixmap rows [y0, y1).
+ */
+static void render_density(gp_pixmap *p, const int full,
+			   const uint32_t y0, const uint32_t y1)
+{
+	const size_t cells = ca1d_cells();
+	size_t *c0 = malloc((p->w + 1) * sizeof(size_t));
+	uint64_t *acc = malloc(p->w * sizeof(uint64_t));
+	gp_pixel palette[256];
+	uint32_t x, x0, x1, y;
+	size_t j, start, end;
+
+	if (!c0 || !acc)
+		goto out;
+
+	if (y0 < y1 && pops_update(density_rows_end(p, y1 - 1)))
+		goto out;
+
+	for (x = 0; x < 256; x++)
+		palette[x] = gp_rgb_to_pixmap_pixel(0xff - x, 0xff - x, 0xff - x, p);
+
+	for (x = 0; x <= p->w; x++)
+		c0[x] = (uint64_t)x * cells / p->w;
+
+	for (y = y0; y < y1; y++) {
+		const size_t j0 = (uint64_t)y * height / p->h;
+		const size_t j1 = density_rows_end(p, y);
+
+		if (!rows_dirty(j0, j1, full, &start, &end))
+			continue;
+
+		x0 = (uint64_t)64 * start * p->w / cells;
+		x1 = GP_MIN((uint64_t)p->w,
+			    ((uint64_t)64 * end * p->w + cells - 1) / cells + 1);
+
+		memset(acc, 0, p->w * sizeof(uint64_t));
+
+		for (j = j0; j < j1; j++) {
+			for (x = x0; x < x1; x++) {
+				const size_t c1 = GP_MAX(c0[x] + 1, c0[x + 1]);
+
+				acc[x] += row_cells_pop(j, c0[x], c1);
+			}
+		}
+
+		for (x = x0; x < x1; x++) {
+			const size_t c1 = GP_MAX(c0[x] + 1, c0[x + 1]);
+			const uint64_t block = (j1 - j0) * (c1 - c0[x]);
+
+			gp_putpixel_raw(p, x, y, palette[acc[x] * 255 / block]);
+		}
+	}
+
+out:
+	free(c0);
+	free(acc);
+}
+
+/* Everything besides init which the steps depend on
+ *
+ * Only the rules in use are set, and the padding is zeroed so the keys
+ * can be compared with memcmp.
+ */
+struct ca1d_key {
+	size_t width, height;
+	unsigned int tail;
+	enum ca1d_boundary boundary;
+	enum ca1d_rule_kind kind;
+	unsigned int radius;
+	uint64_t number[2];
+	uint8_t rules[256];
+	uint8_t rule_n;
+	uint8_t meta_rule;
+	int reversible;
+};
+
+/* The key of the steps which are done */
+static struct ca1d_key steps_key;
+
+static void ca1d_key_get(struct ca1d_key *key)
+{
+	memset(key, 0, sizeof(*key));
+
+	key->width = width;
+	key->height = height;
+	key->tail = tail;
+	key->boundary = boundary;
+	key->kind = wide_rule.kind;
+	key->radius = wide_rule.radius;
+	memcpy(key->number, wide_rule.number, sizeof(key->number));
+	memcpy(key->rules, rules, ca1d_rules_used());
+	key->rule_n = rule_n;
+	key->meta_rule = meta_rule;
+	key->reversible = reversible;
+}
+
+/* Set what the steps depend on from a key made by ca1d_key_get */
+static void ca1d_key_set(const struct ca1d_key *key)
+{
+	width = key->width;
+	height = key->height;
+	tail = key->tail;
+	boundary = key->boundary;
+	ca1d_wide_rule_set(key->kind, key->radius, key->number);
+	memcpy(rules, key->rules, sizeof(rules));
+	rule_n = key->rule_n;
+	meta_rule = key->meta_rule;
+	reversible = key->reversible;
+}
+
+/* Remembers the last step given to the sinks after it */
+static int ca1d_count_row(struct ca1d_sink *self, const uint64_t *row, size_t i)
+{
+	size_t *last = self->priv;
+
+	(void)row;
+	*last = i;
+
+	return 0;
+}
+
+/* Bring steps up to date with init and the rules, passing each step to
+ * sink if not NULL once it is done
+ *
+ * If only init changed since the last update, then just the segments
+ * which the change can reach are recomputed. They grow by a segment on
+ * each side per step, but the new segments are compared with the old so
+ * the range shrinks again wherever the change dies out. Once the range
+ * covers a whole row, or reaches the steps which the last update did not
+ * get to because its sink stopped it, the remaining steps are evolved as
+ * usual.
+ *
+ * Any other change to what the steps depend on, as recorded by
+ * ca1d_key, recomputes all of them. Otherwise nothing is recomputed, so
+ * redrawing the same automaton is cheap.
+ *
+ * The changed segments of each row are recorded in dirty before the row
+ * is given to the sink.
+ */
+static void ca1d_update(struct ca1d_sink *sink)
+{
+	const ssize_t w = width;
+	const ssize_t spread = ca1d_spread();
+	size_t last = 0;
+	struct ca1d_sink count = {
+		.row = ca1d_count_row,
+		.next = sink,
+		.priv = &last,
+	};
+	struct ca1d_key key;
+	size_t done, i, j, from;
+	ssize_t lo, hi, u;
+
+	if (!dirty || !steps_init || !scratch) {
+		ca1d_run(sink);
+		return;
+	}
+
+	ca1d_key_get(&key);
+	if (memcmp(&key, &steps_key, sizeof(key))) {
+		steps_key = key;
+		steps_done = 0;
+	}
+
+	done = from = steps_done;
+
+	if (!done) {
+		memcpy(steps_init, init, width * sizeof(uint64_t));
+
+		for (j = 0; j < height; j++)
+			dirty[j] = (struct ca1d_span){ 0, w };
+
+		steps_done = ca1d_run(&count) ? last + 1 : height;
+		return;
+	}
+
+	for (lo = 0; lo < w && steps_init[lo] == init[lo]; lo++)
+		;
+	for (hi = w; hi > lo && steps_init[hi - 1] == init[hi - 1]; hi--)
+		;
+
+	ca1d_active_set();
+	memcpy(ca1d_row(0), init, width * sizeof(uint64_t));
+	ca1d_step_spans_add(0, (struct ca1d_span){ 0, w });
+	memcpy(steps_init, init, width * sizeof(uint64_t));
+	dirty[0] = (struct ca1d_span){ lo, hi };
+	steps_done = 1;
+
+	if (lo < hi && pops_rows)
+		pops_row(0);
+
+	if (ca1d_sink_row(sink, ca1d_row(0), 0))
+		return;
+
+	for (i = 1; i < done; i++) {
+		const struct ca1d_span *above = dirty + i - 1;
+		struct ca1d_span c = { above->lo - spread, above->hi + spread };
+		uint64_t *next = ca1d_row(i);
+		ssize_t off;
+
+		if (above->lo >= above->hi)
+			c = (struct ca1d_span){ 0, 0 };
+
+		if (reversible && i > 1 && dirty[i - 2].lo < dirty[i - 2].hi) {
+			const struct ca1d_span *prev = dirty + i - 2;
+
+			if (c.lo >= c.hi) {
+				c = *prev;
+			} else {
+				c.lo = GP_MIN(c.lo, prev->lo);
+				c.hi = GP_MAX(c.hi, prev->hi);
+			}
+		}
+
+		if (c.lo >= c.hi)
+			break;
+
+		if (c.hi - c.lo >= w) {
+			from = i;
+			break;
+		}
+
+		off = c.lo - ((c.lo % w) + w) % w;
+		ca1d_step_range_to(i, scratch, c.lo - off, c.hi - off);
+
+		lo = c.hi;
+		hi = c.lo;
+		for (u = c.lo; u < c.hi; u++) {
+			const size_t x = u - off < w ? u - off : u - off - w;
+
+			if (scratch[x] == next[x])
+				continue;
+
+			next[x] = scratch[x];
+			lo = GP_MIN(lo, u);
+			hi = u + 1;
+		}
+
+		dirty[i] = (struct ca1d_span){ lo, hi };
+		ca1d_step_spans_add(i, ca1d_active_span(i));
+		steps_done = i + 1;
+		CA1D_STAT_ADD(rows, 1);
+
+		if (lo < hi && i < pops_rows)
+			pops_row(i);
+
+		if (ca1d_sink_row(sink, next, i))
+			return;
+	}
+
+	for (j = i; j < height; j++)
+		dirty[j] = j < from ? (struct ca1d_span){ 0, 0 } : (struct ca1d_span){ 0, w };
+
+	pops_rows = GP_MIN(pops_rows, from);
+	steps_done = from;
+
+	if (from < height)
+		steps_done = ca1d_resume(&count, from) ? last + 1 : height;
+}
+
+/* A saved run starts with this header, followed by init, init_prev and
+ * the bands of rows. The offsets of the bands are in an index at the
+ * end, so a run can be written as it is computed and any row read back
+ * by decoding only its band. Everything is little endian.
+ */
+struct run_header {
+	char magic[8];
+	uint64_t width;
+	uint64_t height;
+	/* Rows per band, the last band may have fewer */
+	uint64_t band_rows;
+	/* File offset of the index, one offset per band and then the end */
+	uint64_t index;
+	uint8_t rules[256];
+	uint8_t rule_n;
+	uint8_t meta_rule;
+	uint8_t reversible;
+	/* Cells in the last segment of a row, zero for all 64 */
+	uint8_t tail;
+	uint8_t boundary;
+	/* A wide rule, its number is in the first 16 bytes of rules */
+	uint8_t kind;
+	uint8_t radius;
+	uint8_t pad[1];
+};
+
+#define RUN_MAGIC "CA1DRUN1"
+
+/* Bands are roughly this size before compression */
+#define RUN_BAND_BYTES (1UL << 20)
+
+/* Store the rules in a header, a wide rule's number goes little endian
+ * in the first 16 bytes of the elementary rules
+ */
+static void header_rules_set(uint8_t hrules[256], uint8_t *kind, uint8_t *radius)
+{
+	unsigned int i;
+
+	memcpy(hrules, rules, sizeof(rules));
+	*kind = wide_rule.kind;
+	*radius = 0;
+
+	if (wide_rule.kind == CA1D_RULE_ELEMENTARY)
+		return;
+
+	*radius = wide_rule.radius;
+	for (i = 0; i < 16; i++)
+		hrules[i] = wide_rule.number[i / 8] >> (8 * (i % 8));
+}
+
+static void header_rules_number(const uint8_t hrules[256], uint64_t number[2])
+{
+	unsigned int i;
+
+	number[0] = number[1] = 0;
+	for (i = 0; i < 16; i++)
+		number[i / 8] |= (uint64_t)hrules[i] << (8 * (i % 8));
+}
+
+static int header_rules_check(const uint8_t hrules[256], const uint8_t kind,
+			      const uint8_t radius)
+{
+	uint64_t number[2];
+
+	header_rules_number(hrules, number);
+
+	return ca1d_wide_rule_check(kind, radius, number);
+}
+
+/* Take the rules from a header checked with header_rules_check */
+static void header_rules_get(const uint8_t hrules[256], const uint8_t kind,
+			     const uint8_t radius)
+{
+	uint64_t number[2];
+
+	memcpy(rules, hrules, sizeof(rules));
+	header_rules_number(hrules, number);
+	ca1d_wide_rule_set(kind, radius, number);
+}
+
+static size_t run_bands(const struct run_header *h)
+{
+	return (h->height + h->band_rows - 1) / h->band_rows;
+}
+
+static size_t run_band_size(const struct run_header *h, const size_t b)
+{
+	const size_t rows = GP_MIN(h->band_rows, h->height - b * h->band_rows);
+
+	return rows * h->width * sizeof(uint64_t);
+}
+
+static void run_words_to_le(uint64_t *dst, const uint64_t *src, const size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		dst[i] = htole64(src[i]);
+}
+
+static void run_words_from_le(uint64_t *dst, const uint64_t *src, const size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		dst[i] = le64toh(src[i]);
+}
+
+/* Writes the rows to a run file a band at a time
+ *
+ * Bands are compressed with zlib when it is available and the band gets
+ * smaller, otherwise they are stored as they are.
+ */
+struct run_writer {
+	FILE *f;
+	struct run_header h;
+	uint64_t *band;
+	size_t rows;
+	uint64_t *index;
+	size_t bands;
+	uint8_t *packed;
+	size_t packed_size;
+};
+
+static int run_writer_open(struct run_writer *self, const char *path)
+{
+	const size_t row_bytes = width * sizeof(uint64_t);
+	uint64_t *words = NULL;
+	size_t i;
+
+	memset(self, 0, sizeof(*self));
+	memcpy(self->h.magic, RUN_MAGIC, sizeof(self->h.magic));
+	self->h.width = width;
+	self->h.band_rows = GP_MAX(1UL, RUN_BAND_BYTES / row_bytes);
+	header_rules_set(self->h.rules, &self->h.kind, &self->h.radius);
+	self->h.rule_n = rule_n;
+	self->h.meta_rule = meta_rule;
+	self->h.reversible = reversible;
+	self->h.tail = tail % 64;
+	self->h.boundary = boundary;
+
+	self->band = malloc(self->h.band_rows * row_bytes);
+	self->index = malloc(((height + self->h.band_rows - 1) / self->h.band_rows + 1) *
+			     sizeof(uint64_t));
+	self->packed_size = self->h.band_rows * row_bytes;
+#ifdef HAVE_ZLIB
+	self->packed_size = compressBound(self->packed_size);
+#endif
+	self->packed = malloc(self->packed_size);
+	words = malloc(2 * row_bytes);
+
+	if (!self->band || !self->index || !self->packed || !words)
+		goto err;
+
+	self->f = fopen(path, "wb");
+	if (!self->f)
+		goto err;
+
+	/* The header is written again with the height and index at the end */
+	run_words_to_le(words, init, width);
+	run_words_to_le(words + width, init_prev, width);
+
+	if (fwrite(&self->h, sizeof(self->h), 1, self->f) != 1 ||
+	    fwrite(words, row_bytes, 2, self->f) != 2) {
+		fclose(self->f);
+		goto err;
+	}
+
+	self->index[0] = sizeof(self->h) + 2 * row_bytes;
+	free(words);
+
+	return 0;
+err:
+	i = errno;
+	free(words);
+	free(self->band);
+	free(self->index);
+	free(self->packed);
+	errno = i;
+	return 1;
+}
+
+static int run_writer_flush(struct run_writer *self)
+{
+	const size_t size = self->rows * self->h.width * sizeof(uint64_t);
+	const void *data = self->band;
+	size_t len = size;
+
+	if (!self->rows)
+		return 0;
+
+#ifdef HAVE_ZLIB
+	uLongf packed = self->packed_size;
+
+	if (compress2(self->packed, &packed, (const Bytef *)self->band, size, 1) == Z_OK &&
+	    packed < size) {
+		data = self->packed;
+		len = packed;
+	}
+#endif
+
+	if (fwrite(data, 1, len, self->f) != len)
+		return 1;
+
+	self->index[self->bands + 1] = self->index[self->bands] + len;
+	self->bands++;
+	self->h.height += self->rows;
+	self->rows = 0;
+
+	return 0;
+}
+
+static int run_writer_row(struct run_writer *self, const uint64_t *row)
+{
+	run_words_to_le(self->band + self->rows * width, row, width);
+
+	if (++self->rows < self->h.band_rows)
+		return 0;
+
+	return run_writer_flush(self);
+}
+
+/* Write the last band, the index and the final header, then close */
+static int run_writer_finish(struct run_writer *self)
+{
+	static const uint8_t pad[sizeof(uint64_t)];
+	int ret = run_writer_flush(self);
+	size_t i, n;
+
+	/* The index is aligned so that it can be read from the mapping */
+	n = -self->index[self->bands] % sizeof(uint64_t);
+	ret = ret || fwrite(pad, 1, n, self->f) != n;
+
+	self->h.index = self->index[self->bands] + n;
+	for (i = 0; i <= self->bands; i++)
+		self->index[i] = htole64(self->index[i]);
+
+	self->h.width = htole64(self->h.width);
+	self->h.height = htole64(self->h.height);
+	self->h.band_rows = htole64(self->h.band_rows);
+	self->h.index = htole64(self->h.index);
+
+	ret = ret || fwrite(self->index, sizeof(uint64_t), self->bands + 1, self->f) != self->bands + 1;
+	ret = ret || fseek(self->f, 0, SEEK_SET);
+	ret = ret || fwrite(&self->h, sizeof(self->h), 1, self->f) != 1;
+	ret = fclose(self->f) || ret;
+
+	free(self->band);
+	free(self->index);
+	free(self->packed);
+
+	return ret;
+}
+
+static int run_sink_row(struct ca1d_sink *self, const uint64_t *row, size_t i)
+{
+	(void)i;
+
+	if (!run_writer_row(self->priv, row))
+		return 0;
+
+	perror("Writing run failed");
+	return 1;
+}
+
+static struct run_writer run_writer;
+
+static struct ca1d_sink run_sink = {
+	.row = run_sink_row,
+	.priv = &run_writer,
+};
+
+/* A run file mapped into memory, rows are decoded a band at a time */
+struct run_file {
+	uint8_t *map;
+	size_t size;
+	struct run_header h;
+	const uint64_t *index;
+	uint64_t *band;
+	size_t band_i;
+};
+
+static int run_file_open(struct run_file *self, const char *path)
+{
+	const struct run_header *h;
+	struct stat st;
+	size_t i, bands;
+	int fd;
+
+	memset(self, 0, sizeof(*self));
+	self->band_i = SIZE_MAX;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return 1;
+
+	if (fstat(fd, &st)) {
+		close(fd);
+		return 1;
+	}
+
+	self->size = st.st_size;
+	self->map = self->size < sizeof(*h) ? MAP_FAILED :
+		mmap(NULL, self->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (self->map == MAP_FAILED) {
+		self->map = NULL;
+		errno = EINVAL;
+		return 1;
+	}
+
+	h = (const struct run_header *)self->map;
+	self->h = *h;
+	self->h.width = le64toh(h->width);
+	self->h.height = le64toh(h->height);
+	self->h.band_rows = le64toh(h->band_rows);
+	self->h.index = le64toh(h->index);
+
+	errno = EINVAL;
+	if (memcmp(h->magic, RUN_MAGIC, sizeof(h->magic)) || !self->h.width ||
+	    !self->h.height || !self->h.band_rows ||
+	    self->h.width > SIZE_MAX / sizeof(uint64_t) / self->h.band_rows ||
+	    self->h.index % sizeof(uint64_t) || self->h.tail >= 64 ||
+	    self->h.boundary > CA1D_BOUNDARY_REFLECT || !self->h.rule_n ||
+	    header_rules_check(self->h.rules, self->h.kind, self->h.radius))
+		goto err;
+
+	bands = run_bands(&self->h);
+
+	if (self->h.index > self->size ||
+	    (self->size - self->h.index) / sizeof(uint64_t) < bands + 1)
+		goto err;
+
+	self->index = (const uint64_t *)(self->map + self->h.index);
+
+	for (i = 0; i < bands; i++) {
+		if (le64toh(self->index[i]) > le64toh(self->index[i + 1]) ||
+		    le64toh(self->index[i + 1]) > self->h.index)
+			goto err;
+	}
+
+	if (le64toh(self->index[0]) < sizeof(*h) + 2 * self->h.width * sizeof(uint64_t))
+		goto err;
+
+	self->band = malloc(self->h.band_rows * self->h.width * sizeof(uint64_t));
+	if (!self->band)
+		goto err;
+
+	return 0;
+err:
+	munmap(self->map, self->size);
+	self->map = NULL;
+	return 1;
+}
+
+static void run_file_close(struct run_file *self)
+{
+	if (!self->map)
+		return;
+
+	munmap(self->map, self->size);
+	free(self->band);
+	self->map = NULL;
+}
+
+/* Decode row i of the run into row, returns non-zero if the file is bad */
+static int run_file_row(struct run_file *self, const size_t i, uint64_t *row)
+{
+	const size_t w = self->h.width;
+	const size_t b = i / self->h.band_rows;
+
+	if (i >= self->h.height)
+		return 1;
+
+	if (b != self->band_i) {
+		const size_t size = run_band_size(&self->h, b);
+		const size_t start = le64toh(self->index[b]);
+		const size_t len = le64toh(self->index[b + 1]) - start;
+
+		if (len == size) {
+			memcpy(self->band, self->map + start, size);
+		} else {
+#ifdef HAVE_ZLIB
+			uLongf unpacked = size;
+
+			if (uncompress((Bytef *)self->band, &unpacked,
+				       self->map + start, len) != Z_OK || unpacked != size)
+				return 1;
+#else
+			return 1;
+#endif
+		}
+
+		self->band_i = b;
+	}
+
+	run_words_from_le(row, self->band + (i % self->h.band_rows) * w, w);
+
+	return 0;
+}
+
+/* Take the rules and size from a run, starting from its step from
+ *
+ * The height is the rest of the run, or less if max is smaller.
+ */
+static int run_file_apply(const struct run_file *self, const size_t from,
+			  const size_t max)
+{
+	if (from >= self->h.height)
+		return 1;
+
+	width = self->h.width;
+	tail = self->h.tail ? self->h.tail : 64;
+	boundary = self->h.boundary;
+	height = GP_MIN(max, self->h.height - from);
+	header_rules_get(self->h.rules, self->h.kind, self->h.radius);
+	rule_n = self->h.rule_n;
+	meta_rule = self->h.meta_rule;
+	reversible = self->h.reversible;
+
+	return 0;
+}
+
+/* Set init and init_prev to the run's step from and the one before it */
+static int run_file_init(struct run_file *self, const size_t from)
+{
+	const uint64_t *words = (const uint64_t *)(self->map + sizeof(self->h));
+
+	if (!from) {
+		run_words_from_le(init_prev, words + width, width);
+	} else if (run_file_row(self, from - 1, init_prev)) {
+		return 1;
+	}
+
+	if (!reversible)
+		memset(init_prev, 0, width * sizeof(uint64_t));
+
+	return run_file_row(self, from, init);
+}
+
+/* Read the steps from step from of the run instead of evolving them,
+ * passing each to sink if not NULL
+ *
+ * When the steps are kept they are recorded as computed, so editing the
+ * automaton afterwards only recomputes what it changes.
+ *
+ * Returns non-zero if the sink stopped early or the run is corrupt.
+ */
+static int run_file_load(struct run_file *self, const size_t from,
+			 struct ca1d_sink *sink)
+{
+	int ret = 0;
+	size_t i;
+
+	pops_rows = 0;
+
+	for (i = 0; i < height; i++) {
+		if (run_file_row(self, from + i, ca1d_row(i))) {
+			fprintf(stderr, "Reading row %zu of the run failed\n", from + i);
+			return 1;
+		}
+
+		ca1d_step_spans_add(i, (struct ca1d_span){ 0, width });
+
+		if (ca1d_sink_row(sink, ca1d_row(i), i)) {
+			ret = 1;
+			i++;
+			break;
+		}
+	}
+
+	if (streaming)
+		return ret;
+
+	ca1d_key_get(&steps_key);
+	memcpy(steps_init, init, width * sizeof(uint64_t));
+	steps_done = i;
+
+	for (i = 0; i < height; i++)
+		dirty[i] = (struct ca1d_span){ 0, width };
+
+	return ret;
+}
+
+/* Save all the steps to a run file */
+static int run_save(const char *path)
+{
+	struct run_writer writer;
+	size_t i;
+
+	/* Runs are the steps of a 1D automaton */
+	if (ca2d) {
+		errno = ENOTSUP;
+		return 1;
+	}
+
+	if (run_writer_open(&writer, path))
+		return 1;
+
+	for (i = 0; i < height; i++) {
+		if (run_writer_row(&writer, ca1d_row(i))) {
+			run_writer_finish(&writer);
+			return 1;
+		}
+	}
+
+	return run_writer_finish(&writer);
+}
+
+static inline int pixmap_downsampled(const gp_pixmap *p)
+{
+	return ca1d_cells() > p->w || height > p->h;
+}
+
+/* End of the steps shown in row y of the pixmap */
+static size_t pixmap_rows_end(const gp_pixmap *p, const uint32_t y)
+{
+	const float ph = (float)height / (float)p->h;
+
+	if (pixmap_downsampled(p))
+		return density_rows_end(p, y);
+
+	return (size_t)((float)y * ph) + 1;
+}
+
+/* Number of leading pixmap rows which only show steps before rows */
+static uint32_t pixmap_rows_ready(const gp_pixmap *p, const size_t rows)
+{
+	uint32_t lo = 0, hi = p->h;
+
+	while (lo < hi) {
+		const uint32_t mid = hi - (hi - lo) / 2;
+
+		if (pixmap_rows_end(p, mid - 1) <= rows)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	return lo;
+}
+
+/* Shade the pixmap rows [y0, y1) with whichever renderer fits its size */
+static void render_steps(gp_pixmap *p, const int full,
+			 const uint32_t y0, const uint32_t y1)
+{
+	gp_pixel bg = gp_rgb_to_pixmap_pixel(0xff, 0xff, 0xff, p);
+	gp_pixel fg = gp_rgb_to_pixmap_pixel(0x00, 0x00, 0x00, p);
+	float pw = (float)ca1d_cells() / (float)p->w;
+	float ph = (float)height / (float)p->h;
+	CA1D_STAT_STAMP(t);
+
+	if (pixmap_downsampled(p))
+		render_density(p, full, y0, y1);
+	else
+		render_pixmap(p, pw, ph, bg, fg, full, y0, y1);
+
+	CA1D_STAT_SINCE(shade_ns, t);
+}
+
+/* Steps evolved between shading the pixmap rows which show them */
+#define GUI_BAND_ROWS 64
+/* Period of checking for newly shaded pixmap rows */
+#define GUI_REDRAW_MS 20
+
+/* Simulation and shading of the pixmap widget off the event thread
+ *
+ * The job shades the pixmap from the top as bands of steps are done, and
+ * a timer on the event thread redraws the widget as they arrive. The
+ * state of the automaton may only be changed while no job is running.
+ */
+struct gui_job {
+	pthread_t thread;
+	gp_pixmap *p;
+	/* Shade all of the pixmap rather than the changed steps */
+	int full;
+	int running;
+	/* Set by the event thread to stop the job early */
+	unsigned int cancel;
+	/* Set by the job once its thread can be joined */
+	unsigned int done;
+	/* Leading pixmap rows which are shaded */
+	uint32_t drawn;
+	/* Leading pixmap rows which the widget was redrawn with */
+	uint32_t shown;
+	/* Step after which the next band of pixmap rows is shaded */
+	size_t band;
+	/* 2D generations shaded, asked to be redrawn and known to be shown */
+	uint32_t frame;
+	uint32_t frame_redrawn;
+	uint32_t frame_shown;
+};
+
+static struct gui_job gui_job;
+/* Whether a stopped job left some of the pixmap unshaded */
+static int gui_repaint;
+
+/* A zoomable view of any part of the automaton's spacetime
+ *
+ * Panning or zooming the pixmap switches it from showing the steps
+ * matrix to the view, which is not limited to the height. Its steps are
+ * evolved in bands of VIEW_TILE_ROWS, the tiles, only as they come into
+ * sight and the most recently used are cached. The two steps before
+ * each band evolved are kept as a keyframe, so a tile is evolved from
+ * the nearest keyframe rather than the initial conditions, and long
+ * distances are jumped with the quadtree when the rules allow it. So
+ * the work done is that of the tiles on screen, not of all the steps
+ * before them.
+ *
+ * The view is only changed while no job is running.
+ */
+#define VIEW_TILE_ROWS 256
+/* Memory for the cached tiles */
+#define VIEW_CACHE_BYTES (64UL << 20)
+#define VIEW_TILES_MAX 1024
+/* Bands between the keyframes kept when moving further than this */
+#define VIEW_FRAME_JUMP 32
+/* Memory for the keyframes */
+#define VIEW_FRAME_BYTES (64UL << 20)
+#define VIEW_FRAMES_MAX 4096
+/* Zoom limits, as log2 of the cells per pixel */
+#define VIEW_ZOOM_MIN -4
+#define VIEW_ZOOM_MAX 24
+
+struct view_tile {
+	int64_t band;
+	/* The clock when it was last used */
+	uint64_t used;
+	/* The band's steps and the one after it */
+	uint64_t *rows;
+	uint32_t *pops;
+};
+
+/* Steps band * VIEW_TILE_ROWS - 1 and band * VIEW_TILE_ROWS */
+struct view_frame {
+	int64_t band;
+	uint64_t *rows;
+};
+
+static struct view {
+	/* Whether the pixmap shows the view rather than the steps matrix */
+	int on;
+	/* The step and cell at the top left pixel */
+	int64_t top, left;
+	/* log2 of the cells and steps per pixel, negative when zoomed in */
+	int zoom;
+	/* Pixels dragged by which do not add up to a cell yet */
+	int32_t drag_x, drag_y;
+	/* What the tiles are evolved from, init_prev follows init */
+	struct ca1d_key key;
+	uint64_t *init;
+	struct view_tile *tiles;
+	size_t tile_n, tile_max;
+	uint64_t clock;
+	/* Sorted by band */
+	struct view_frame *frames;
+	size_t frame_n, frame_max;
+} view;
+
+/* A non-negative number of pixels in cells or steps */
+static inline int64_t view_scale(const int64_t v)
+{
+	return view.zoom >= 0 ? v << view.zoom : v >> -view.zoom;
+}
+
+/* The band of step j, rounding down before the initial conditions */
+static inline int64_t view_band(const int64_t j)
+{
+	return j >= 0 ? j / VIEW_TILE_ROWS : -((VIEW_TILE_ROWS - 1 - j) / VIEW_TILE_ROWS);
+}
+
+static void view_flush(void)
+{
+	size_t i;
+
+	for (i = 0; i < view.tile_n; i++) {
+		free(view.tiles[i].rows);
+		free(view.tiles[i].pops);
+	}
+
+	for (i = 0; i < view.frame_n; i++)
+		free(view.frames[i].rows);
+
+	free(view.tiles);
+	free(view.frames);
+	free(view.init);
+	view.tiles = NULL;
+	view.frames = NULL;
+	view.init = NULL;
+	view.tile_n = view.frame_n = 0;
+}
+
+/* Keep the keyframe of band, once there are too many every other one
+ * is dropped except for the initial conditions
+ */
+static struct view_frame *view_frame_add(const int64_t band, const uint64_t *prev,
+					 const uint64_t *cur)
+{
+	const size_t row_bytes = width * sizeof(uint64_t);
+	uint64_t *rows;
+	size_t i, n;
+
+	if (view.frame_n == view.frame_max) {
+		for (i = n = 0; i < view.frame_n; i++) {
+			if (i & 1 && view.frames[i].band) {
+				free(view.frames[i].rows);
+				continue;
+			}
+
+			view.frames[n++] = view.frames[i];
+		}
+
+		view.frame_n = n;
+	}
+
+	for (i = 0; i < view.frame_n && view.frames[i].band < band; i++)
+		;
+
+	if (i < view.frame_n && view.frames[i].band == band)
+		return view.frames + i;
+
+	rows = malloc(2 * row_bytes);
+	if (!rows)
+		return NULL;
+
+	memcpy(rows, prev, row_bytes);
+	memcpy(rows + width, cur, row_bytes);
+	memmove(view.frames + i + 1, view.frames + i,
+		(view.frame_n - i) * sizeof(*view.frames));
+	view.frames[i] = (struct view_frame){ band, rows };
+	view.frame_n++;
+
+	return view.frames + i;
+}
+
+/* Start again if the automaton changed since the tiles were evolved */
+static int view_check(void)
+{
+	const size_t row_bytes = width * sizeof(uint64_t);
+	const uint64_t *prev = reversible ? init_prev : zeroes;
+	const size_t tile_bytes = (VIEW_TILE_ROWS + 1) * row_bytes +
+		VIEW_TILE_ROWS * width * sizeof(uint32_t);
+	struct ca1d_key key;
+
+	ca1d_key_get(&key);
+	/* The view goes past the height */
+	key.height = 0;
+
+	if (view.init && !memcmp(&key, &view.key, sizeof(key)) &&
+	    !memcmp(view.init, init, row_bytes) &&
+	    !memcmp(view.init + width, prev, row_bytes))
+		return 0;
+
+	view_flush();
+	view.key = key;
+	view.clock = 0;
+	view.tile_max = GP_MAX(2UL, GP_MIN((size_t)VIEW_TILES_MAX, VIEW_CACHE_BYTES / tile_bytes));
+	view.frame_max = GP_MAX(2UL, GP_MIN((size_t)VIEW_FRAMES_MAX, VIEW_FRAME_BYTES / (2 * row_bytes)));
+	view.init = malloc(2 * row_bytes);
+	view.tiles = calloc(view.tile_max, sizeof(*view.tiles));
+	view.frames = malloc(view.frame_max * sizeof(*view.frames));
+
+	if (!view.init || !view.tiles || !view.frames)
+		goto err;
+
+	memcpy(view.init, init, row_bytes);
+	memcpy(view.init + width, prev, row_bytes);
+
+	if (!view_frame_add(0, view.init + width, view.init))
+		goto err;
+
+	return 0;
+err:
+	view_flush();
+	return 1;
+}
+
+/* The keyframe of band, evolved from the nearest one if it is not kept
+ *
+ * The keyframes passed on the way are kept, spaced out so that there
+ * are at most VIEW_FRAME_JUMP of them. Returns NULL if the job was
+ * cancelled, the memory ran out or the band is before the initial
+ * conditions of a run which is not reversible.
+ */
+static const struct view_frame *view_frame_get(struct gui_job *job,
+					       const int64_t band)
+{
+	const size_t row_bytes = width * sizeof(uint64_t);
+	const struct view_frame *from = NULL;
+	const struct view_frame *ret = NULL;
+	uint64_t *pair, spacing = 1, d;
+	int64_t b;
+	int dir;
+	size_t i;
+
+	for (i = 0; i < view.frame_n; i++) {
+		const struct view_frame *f = view.frames + i;
+
+		if (f->band == band)
+			return f;
+
+		/* Later keyframes can only be stepped back from in reversible mode */
+		if (f->band > band && !reversible)
+			break;
+
+		if (!from || llabs(f->band - band) < llabs(from->band - band))
+			from = f;
+	}
+
+	if (!from)
+		return NULL;
+
+	pair = malloc(2 * row_bytes);
+	if (!pair)
+		return NULL;
+
+	memcpy(pair, from->rows, 2 * row_bytes);
+	dir = from->band < band ? 1 : -1;
+	d = llabs(band - from->band);
+	b = from->band;
+
+	while (spacing * VIEW_FRAME_JUMP < d)
+		spacing <<= 1;
+
+	/* The pair swapped around evolves backwards */
+	if (d > VIEW_FRAME_JUMP) {
+		uint64_t *prev = dir > 0 ? pair : pair + width;
+		uint64_t *cur = dir > 0 ? pair + width : pair;
+
+		CA1D_STAT_STAMP(sim);
+		if (!ca1d_hl_pair_advance(prev, cur, d * VIEW_TILE_ROWS)) {
+			b = band;
+			d = 0;
+		} else {
+			memcpy(pair, from->rows, 2 * row_bytes);
+		}
+		CA1D_STAT_SINCE(sim_ns, sim);
+	}
+
+	for (; d; d--) {
+		if (__atomic_load_n(&job->cancel, __ATOMIC_RELAXED))
+			goto out;
+
+		CA1D_STAT_STAMP(sim);
+		if (ca1d_pair_step(pair, pair + width, dir * VIEW_TILE_ROWS))
+			goto out;
+		CA1D_STAT_SINCE(sim_ns, sim);
+
+		b += dir;
+		if (b != band && !(b % (int64_t)spacing))
+			view_frame_add(b, pair, pair + width);
+	}
+
+	ret = view_frame_add(band, pair, pair + width);
+out:
+	free(pair);
+	return ret;
+}
+
+/* The tile of band, evolved from its keyframe if it is not cached
+ *
+ * Evolving a tile also gives the keyframe of the next, so scrolling on
+ * carries on from it. Returns NULL as view_frame_get does.
+ */
+static const struct view_tile *view_tile_get(struct gui_job *job,
+					     const int64_t band)
+{
+	const size_t row_bytes = width * sizeof(uint64_t);
+	const struct view_frame *f;
+	struct view_tile *t = NULL;
+	uint64_t *rows;
+	size_t i, j;
+
+	for (i = 0; i < view.tile_n; i++) {
+		if (view.tiles[i].band == band) {
+			view.tiles[i].used = ++view.clock;
+			return view.tiles + i;
+		}
+
+		if (!t || view.tiles[i].used < t->used)
+			t = view.tiles + i;
+	}
+
+	f = view_frame_get(job, band);
+	if (!f)
+		return NULL;
+
+	if (view.tile_n < view.tile_max) {
+		t = view.tiles + view.tile_n;
+		t->rows = malloc((VIEW_TILE_ROWS + 1) * row_bytes);
+		t->pops = malloc(VIEW_TILE_ROWS * width * sizeof(uint32_t));
+
+		if (!t->rows || !t->pops) {
+			free(t->rows);
+			free(t->pops);
+			return NULL;
+		}
+
+		view.tile_n++;
+	}
+
+	CA1D_STAT_STAMP(sim);
+	rows = t->rows;
+	memcpy(rows, f->rows + width, row_bytes);
+
+	for (j = 1; j <= VIEW_TILE_ROWS; j++) {
+		const uint64_t *prev = j > 1 ? rows + (j - 2) * width : f->rows;
+
+		ca1d_step_row(reversible ? prev : zeroes, rows + (j - 1) * width,
+			      rows + j * width, 0, width);
+	}
+
+	for (j = 0; j < VIEW_TILE_ROWS; j++)
+		row_pops(rows + j * width, t->pops + j * width);
+
+	t->band = band;
+	t->used = ++view.clock;
+	CA1D_STAT_ADD(words, VIEW_TILE_ROWS * width);
+	CA1D_STAT_ADD(rows, VIEW_TILE_ROWS);
+	CA1D_STAT_SINCE(sim_ns, sim);
+
+	view_frame_add(band + 1, rows + (VIEW_TILE_ROWS - 1) * width,
+		       rows + VIEW_TILE_ROWS * width);
+
+	return t;
+}
+
+/* Shade the view into the job's pixmap from the top as its tiles are
+ * evolved
+ *
+ * As render_density does, each pixel is shaded by the fraction of live
+ * cells in the block it covers, which is a single cell unless zoomed
+ * out. Whatever is outside of the row, or before the initial conditions
+ * without reversible mode, is shaded a pale blue.
+ */
+static void view_render(struct gui_job *job)
+{
+	gp_pixmap *p = job->p;
+	const int64_t cells = ca1d_cells();
+	const int64_t span = view.zoom > 0 ? (int64_t)1 << view.zoom : 1;
+	const gp_pixel outside = gp_rgb_to_pixmap_pixel(0xc8, 0xd4, 0xe8, p);
+	size_t *c0 = malloc(p->w * sizeof(size_t));
+	size_t *c1 = malloc(p->w * sizeof(size_t));
+	uint64_t *acc = malloc(p->w * sizeof(uint64_t));
+	const struct view_tile *t = NULL;
+	int64_t j, j0, prev_j0 = INT64_MIN;
+	gp_pixel palette[256];
+	uint64_t rows_in;
+	uint32_t x, y;
+
+	if (!c0 || !c1 || !acc)
+		goto out;
+
+	for (x = 0; x < 256; x++)
+		palette[x] = gp_rgb_to_pixmap_pixel(0xff - x, 0xff - x, 0xff - x, p);
+
+	for (x = 0; x < p->w; x++) {
+		const int64_t c = view.left + view_scale(x);
+
+		c0[x] = GP_MIN(GP_MAX(c, 0), cells);
+		c1[x] = GP_MIN(GP_MAX(c + span, 0), cells);
+	}
+
+	for (y = 0; y < p->h; y++) {
+		uint8_t *line = p->pixels + (size_t)y * p->bytes_per_row;
+
+		j0 = view.top + view_scale(y);
+
+		if (j0 == prev_j0) {
+			memcpy(line, line - p->bytes_per_row, p->bytes_per_row);
+			goto drawn;
+		}
+
+		memset(acc, 0, p->w * sizeof(uint64_t));
+		rows_in = 0;
+
+		for (j = j0; j < j0 + span; j++) {
+			const int64_t band = view_band(j);
+			const size_t r = j - band * VIEW_TILE_ROWS;
+
+			if (band < 0 && !reversible)
+				continue;
+
+			if (!t || t->band != band) {
+				if (__atomic_load_n(&job->cancel, __ATOMIC_RELAXED))
+					goto out;
+
+				t = view_tile_get(job, band);
+				if (!t)
+					goto out;
+			}
+
+			for (x = 0; x < p->w; x++) {
+				if (c0[x] < c1[x])
+					acc[x] += cells_pop(t->rows + r * width, t->pops + r * width,
+							    c0[x], c1[x]);
+			}
+
+			rows_in++;
+		}
+
+		for (x = 0; x < p->w; x++) {
+			const uint64_t block = rows_in * (c1[x] - c0[x]);
+
+			gp_putpixel_raw(p, x, y, block ? palette[acc[x] * 255 / block] : outside);
+		}
+
+		prev_j0 = j0;
+drawn:
+		__atomic_store_n(&job->drawn, y + 1, __ATOMIC_RELEASE);
+	}
+
+out:
+	free(c0);
+	free(c1);
+	free(acc);
+}
+
+/* Show the view, starting at the same zoom as the whole automaton */
+static void view_enter(const gp_pixmap *p)
+{
+	if (view.on)
+		return;
+
+	view.on = 1;
+	view.top = view.left = 0;
+	view.drag_x = view.drag_y = 0;
+
+	for (view.zoom = VIEW_ZOOM_MIN; view.zoom < VIEW_ZOOM_MAX; view.zoom++) {
+		if (view_scale(p->w) >= (int64_t)ca1d_cells() &&
+		    view_scale(p->h) >= (int64_t)height)
+			break;
+	}
+}
+
+/* Move the view by dx and dy pixels
+ *
+ * Some of the row is kept in sight, as are the steps from the initial
+ * conditions on unless they can be stepped back from.
+ */
+static void view_pan(const gp_pixmap *p, const int32_t dx, const int32_t dy)
+{
+	if (view.zoom >= 0) {
+		view.left += (int64_t)dx << view.zoom;
+		view.top += (int64_t)dy << view.zoom;
+	} else {
+		const int32_t k = 1 << -view.zoom;
+
+		view.drag_x += dx;
+		view.drag_y += dy;
+		view.left += view.drag_x / k;
+		view.top += view.drag_y / k;
+		view.drag_x %= k;
+		view.drag_y %= k;
+	}
+
+	view.left = GP_MIN(view.left, (int64_t)ca1d_cells() - 1);
+	view.left = GP_MAX(view.left, 1 - view_scale(p->w));
+
+	if (!reversible)
+		view.top = GP_MAX(view.top, 0);
+}
+
+/* Zoom in or out by levels, keeping the middle of the pixmap in place */
+static void view_zoom(const gp_pixmap *p, const int levels)
+{
+	const int64_t x = view.left + view_scale(p->w / 2);
+	const int64_t y = view.top + view_scale(p->h / 2);
+
+	view.zoom = GP_MIN(GP_MAX(view.zoom + levels, VIEW_ZOOM_MIN), VIEW_ZOOM_MAX);
+	view.left = x - view_scale(p->w / 2);
+	view.top = y - view_scale(p->h / 2);
+	view.drag_x = view.drag_y = 0;
+	view_pan(p, 0, 0);
+}
+
+static int gui_job_row(struct ca1d_sink *self, const uint64_t *row, size_t i)
+{
+	struct gui_job *job = self->priv;
+	uint32_t ready;
+
+	(void)row;
+
+	if (__atomic_load_n(&job->cancel, __ATOMIC_RELAXED))
+		return 1;
+
+	if (i + 1 < job->band && i + 1 < height)
+		return 0;
+
+	job->band = i + 1 + GUI_BAND_ROWS;
+	ready = pixmap_rows_ready(job->p, i + 1);
+
+	if (ready > job->drawn) {
+		render_steps(job->p, job->full, job->drawn, ready);
+		__atomic_store_n(&job->drawn, ready, __ATOMIC_RELEASE);
+	}
+
+	return 0;
+}
+
+/* Show each generation of a 2D automaton in turn until cancelled
+ *
+ * The next generation is only shaded once the widget has been redrawn
+ * with the last, so the timer sets the pace and a grid is never shown
+ * half shaded.
+ */
+static void gui_job_animate(struct gui_job *job)
+{
+	if (!ca2d_generation)
+		ca2d_seed();
+
+	for (;;) {
+		render_steps(job->p, 1, 0, job->p->h);
+		__atomic_store_n(&job->drawn, job->p->h, __ATOMIC_RELEASE);
+		__atomic_add_fetch(&job->frame, 1, __ATOMIC_RELEASE);
+
+		while (__atomic_load_n(&job->frame_shown, __ATOMIC_ACQUIRE) != job->frame) {
+			if (__atomic_load_n(&job->cancel, __ATOMIC_RELAXED))
+				return;
+
+			usleep(1000);
+		}
+
+		CA1D_STAT_STAMP(sim);
+		ca2d_evolve(1, NULL);
+		CA1D_STAT_SINCE(sim_ns, sim);
+	}
+}
+
+static void *gui_job_main(void *arg)
+{
+	struct gui_job *job = arg;
+	struct ca1d_sink sink = {
+		.row = gui_job_row,
+		.priv = job,
+	};
+	gp_pixmap *p = job->p;
+	uint64_t s, t;
+
+	if (ca2d) {
+		gui_job_animate(job);
+		__atomic_store_n(&job->done, 1, __ATOMIC_RELEASE);
+		return NULL;
+	}
+
+	if (view.on) {
+		if (view_check())
+			perror("Allocating the view failed");
+		else
+			view_render(job);
+
+		__atomic_store_n(&job->done, 1, __ATOMIC_RELEASE);
+		return NULL;
+	}
+
+	if (job->full) {
+		s = gp_time_stamp();
+		gp_fill(p, gp_rgb_to_pixmap_pixel(0xff, 0x00, 0x00, p));
+		t = gp_time_stamp();
+
+		printf("Fill time %lums\n", t - s);
+	}
+
+	s = gp_time_stamp();
+#ifdef CA1D_STATS
+	const uint64_t shade_ns = __atomic_load_n(&ca1d_stats.shade_ns, __ATOMIC_RELAXED);
+	CA1D_STAT_STAMP(sim);
+#endif
+	ca1d_update(&sink);
+#ifdef CA1D_STATS
+	/* The sink shades the bands as they are done */
+	CA1D_STAT_ADD(sim_ns, ca1d_stats_ns() - sim -
+		      (__atomic_load_n(&ca1d_stats.shade_ns, __ATOMIC_RELAXED) - shade_ns));
+#endif
+
+	if (!__atomic_load_n(&job->cancel, __ATOMIC_RELAXED)) {
+		render_steps(p, job->full, job->drawn, p->h);
+		__atomic_store_n(&job->drawn, p->h, __ATOMIC_RELEASE);
+	}
+	t = gp_time_stamp();
+
+	printf("Automata and fill rects time %lums\n", t - s);
+
+	__atomic_store_n(&job->done, 1, __ATOMIC_RELEASE);
+
+	return NULL;
+}
+
+static void gui_job_wait(void)
+{
+	if (!gui_job.running)
+		return;
+
+	pthread_join(gui_job.thread, NULL);
+	gui_job.running = 0;
+
+	if (gui_job.drawn < gui_job.p->h)
+		gui_repaint = 1;
+}
+
+/* Stop the running job, if any, as soon as it finishes its current step */
+static void gui_job_cancel(void)
+{
+	if (!gui_job.running)
+		return;
+
+	__atomic_store_n(&gui_job.cancel, 1, __ATOMIC_RELAXED);
+	gui_job_wait();
+}
+
+static void gui_job_start(gp_pixmap *p, const int full)
+{
+	gui_job_cancel();
+
+	gui_job = (struct gui_job) {
+		.p = p,
+		.full = full || gui_repaint,
+	};
+	gui_repaint = 0;
+
+	if (pthread_create(&gui_job.thread, NULL, gui_job_main, &gui_job)) {
+		perror("pthread_create");
+		gui_job_main(&gui_job);
+		return;
+	}
+
+	gui_job.running = 1;
+}
+
+#ifdef CA1D_STATS
+/* Period of updating the stats label */
+#define GUI_STATS_MS 1000
+
+/* Print n scaled to a k, M or G suffix */
+static void gui_stats_scaled(char *buf, const size_t len, double n)
+{
+	const char *const suffix[] = { "", "k", "M", "G", "T" };
+	unsigned int i;
+
+	for (i = 0; n >= 1000 && i < GP_ARRAY_SIZE(suffix) - 1; i++)
+		n /= 1000;
+
+	snprintf(buf, len, "%.3g%s", n, suffix[i]);
+}
+
+/* Label next to the save button, only created when the stats are */
+static gp_widget *gui_stats_label;
+
+/* Show the work done since the label was last updated, if any
+ *
+ * The rates are per second of simulation time, so a slow redraw can be
+ * told apart from a slow simulation.
+ */
+static void gui_stats_show(void)
+{
+	static struct ca1d_stats last;
+	static uint64_t last_ns;
+	const uint64_t now = ca1d_stats_ns();
+	struct ca1d_stats cur;
+	char words[16], rows[16];
+	uint64_t meta_words;
+	double sim_s;
+
+	if (!gui_stats_label || now - last_ns < GUI_STATS_MS * 1000000ULL)
+		return;
+
+	ca1d_stats_get(&cur);
+
+	if (cur.sim_ns == last.sim_ns && cur.shade_ns == last.shade_ns)
+		return;
+
+	sim_s = GP_MAX(cur.sim_ns - last.sim_ns, 1ULL) / 1e9;
+	gui_stats_scaled(words, sizeof(words), (cur.words - last.words) / sim_s);
+	gui_stats_scaled(rows, sizeof(rows), (cur.rows - last.rows) / sim_s);
+	meta_words = cur.meta_words - last.meta_words;
+
+	gp_widget_label_printf(gui_stats_label,
+			       "Sim %.1fms Shade %.1fms Redraw %.1fms, %s words/s %s rows/s, switched %.0f%%, %lu allocs",
+			       (cur.sim_ns - last.sim_ns) / 1e6,
+			       (cur.shade_ns - last.shade_ns) / 1e6,
+			       (cur.redraw_ns - last.redraw_ns) / 1e6,
+			       words, rows,
+			       meta_words ? 100.0 * (cur.meta_switched - last.meta_switched) / meta_words : 0.0,
+			       (unsigned long)(cur.allocs - last.allocs));
+
+	last = cur;
+	last_ns = now;
+}
+#endif
+
+static uint32_t gui_redraw_on_timer(gp_timer *self)
+{
+	const uint32_t drawn = __atomic_load_n(&gui_job.drawn, __ATOMIC_ACQUIRE);
+	const uint32_t frame = __atomic_load_n(&gui_job.frame, __ATOMIC_ACQUIRE);
+
+	/* The redraw asked for on the last tick has been done by now */
+	__atomic_store_n(&gui_job.frame_shown, gui_job.frame_redrawn, __ATOMIC_RELEASE);
+
+	if (drawn != gui_job.shown || frame != gui_job.frame_redrawn) {
+		CA1D_STAT_STAMP(t);
+
+		gui_job.shown = drawn;
+		gui_job.frame_redrawn = frame;
+		gp_widget_redraw(gp_widget_by_uid(uids, "pixmap", GP_WIDGET_PIXMAP));
+		CA1D_STAT_SINCE(redraw_ns, t);
+	}
+
+	if (__atomic_load_n(&gui_job.done, __ATOMIC_ACQUIRE))
+		gui_job_wait();
+
+#ifdef CA1D_STATS
+	gui_stats_show();
+#endif
+
+	return self->period;
+}
+
+static gp_timer gui_redraw_timer = {
+	.period = GUI_REDRAW_MS,
+	.id = "redraw",
+	.callback = gui_redraw_on_timer,
+};
+
+/* Pixmaps the widget had before, the most recently replaced first
+ *
+ * Resizing back and forth, e.g. maximising and restoring the window,
+ * then reuses one of them rather than allocating a new one.
+ */
+#define GUI_PIXMAP_POOL 4
+static gp_pixmap *gui_pixmap_pool[GUI_PIXMAP_POOL];
+
+/* Take a pixmap of the size and type from the pool, or allocate it */
+static gp_pixmap *gui_pixmap_get(const gp_size w, const gp_size h,
+				 const gp_pixel_type type)
+{
+	unsigned int i;
+
+	for (i = 0; i < GUI_PIXMAP_POOL; i++) {
+		gp_pixmap *p = gui_pixmap_pool[i];
+
+		if (!p || p->w != w || p->h != h || p->pixel_type != type)
+			continue;
+
+		memmove(gui_pixmap_pool + i, gui_pixmap_pool + i + 1,
+			(GUI_PIXMAP_POOL - i - 1) * sizeof(*gui_pixmap_pool));
+		gui_pixmap_pool[GUI_PIXMAP_POOL - 1] = NULL;
+
+		return p;
+	}
+
+	return gp_pixmap_alloc(w, h, type);
+}
+
+/* Keep a pixmap to reuse, freeing the least recently replaced */
+static void gui_pixmap_put(gp_pixmap *p)
+{
+	if (!p)
+		return;
+
+	gp_pixmap_free(gui_pixmap_pool[GUI_PIXMAP_POOL - 1]);
+	memmove(gui_pixmap_pool + 1, gui_pixmap_pool,
+		(GUI_PIXMAP_POOL - 1) * sizeof(*gui_pixmap_pool));
+	gui_pixmap_pool[0] = p;
+}
+
+static void allocate_backing_pixmap(gp_widget_event *ev)
+{
+	gp_widget *w = ev->self;
+	const size_t cells = ca1d_cells();
+	gp_size l = w->w;
+	gp_size h = w->h;
+
+	/* Widen it to a whole number of pixels per cell if that's close */
+	if (cells <= w->w && w->w % cells && cells - w->w % cells < 64)
+		l = w->w + cells - w->w % cells;
+
+	gui_job_cancel();
+
+	gp_pixmap *new_pixmap = gui_pixmap_get(l, h, ev->ctx->pixel_type);
+	gui_pixmap_put(gp_widget_pixmap_set(w, new_pixmap));
+	gui_job_start(new_pixmap, 1);
+}
+
+/* How many steps the GUI's first row is after the initial conditions */
+static int64_t gui_time;
+
+/* Show the step at the top of the pixmap */
+static void gui_time_show(void)
+{
+	gp_widget *label = gp_widget_by_uid(uids, "time", GP_WIDGET_LABEL);
+	const int64_t top = gui_time + (view.on ? view.top : 0);
+
+	if (label)
+		gp_widget_label_printf(label, "%lld", (long long)top);
+}
+
+/* Pan and zoom the view with the arrow and page keys, +, - and the
+ * wheel or by dragging, escape goes back to the whole automaton
+ */
+static int view_on_input(gp_widget_event *ev)
+{
+	gp_pixmap *p = gp_widget_pixmap_get(ev->self);
+	gp_event *in = ev->input_ev;
+	int32_t dx = 0, dy = 0;
+	int levels = 0;
+
+	if (ca2d || !p)
+		return 0;
+
+	switch (in->type) {
+	case GP_EV_KEY:
+		if (in->code == GP_EV_KEY_UP)
+			return 0;
+
+		switch (in->val) {
+		case GP_KEY_LEFT:
+			dx = -(int32_t)GP_MAX(p->w / 8, 1U);
+			break;
+		case GP_KEY_RIGHT:
+			dx = GP_MAX(p->w / 8, 1U);
+			break;
+		case GP_KEY_UP:
+			dy = -(int32_t)GP_MAX(p->h / 8, 1U);
+			break;
+		case GP_KEY_DOWN:
+			dy = GP_MAX(p->h / 8, 1U);
+			break;
+		case GP_KEY_PAGE_UP:
+			dy = -(int32_t)p->h;
+			break;
+		case GP_KEY_PAGE_DOWN:
+			dy = p->h;
+			break;
+		case GP_KEY_EQUAL:
+		case GP_KEY_KP_PLUS:
+			levels = -1;
+			break;
+		case GP_KEY_MINUS:
+		case GP_KEY_KP_MINUS:
+			levels = 1;
+			break;
+		case GP_KEY_ESC:
+			if (!view.on)
+				return 0;
+
+			gui_job_cancel();
+			view.on = 0;
+			gui_time_show();
+			gui_job_start(p, 1);
+			return 1;
+		default:
+			return 0;
+		}
+		break;
+	case GP_EV_REL:
+		if (in->code == GP_EV_REL_WHEEL) {
+			levels = in->val > 0 ? -1 : 1;
+		} else if (in->code == GP_EV_REL_POS && gp_ev_key_pressed(in, GP_BTN_LEFT)) {
+			dx = -in->rel.rx;
+			dy = -in->rel.ry;
+		} else {
+			return 0;
+		}
+		break;
+	default:
+		return 0;
+	}
+
+	gui_job_cancel();
+	view_enter(p);
+
+	if (levels)
+		view_zoom(p, levels);
+	else
+		view_pan(p, dx, dy);
+
+	gui_time_show();
+	gui_job_start(p, 1);
+
+	return 1;
+}
+
+int pixmap_on_event(gp_widget_event *ev)
+{
+	gp_widget_event_dump(ev);
+
+	switch (ev->type) {
+	case GP_WIDGET_EVENT_RESIZE:
+		allocate_backing_pixmap(ev);
+	break;
+	case GP_WIDGET_EVENT_INPUT:
+		return view_on_input(ev);
+	default:
+	break;
+	}
+
+	return 0;
+}
+
+static void pixmap_do_redraw(void)
+{
+	gp_widget *pixmap = gp_widget_by_uid(uids, "pixmap", GP_WIDGET_PIXMAP);
+
+	gui_job_start(gp_widget_pixmap_get(pixmap), 0);
+}
+
+/* Parse a decimal or 0x prefixed hex number of up to 128 bits */
+static int parse_u128(const char *str, uint64_t number[2])
+{
+	const unsigned int base = strncmp(str, "0x", 2) ? 10 : 16;
+	const char *c = base == 16 ? str + 2 : str;
+	uint32_t limbs[4] = { 0 };
+
+	if (!*c)
+		return 1;
+
+	for (; *c; c++) {
+		uint64_t carry;
+		unsigned int i;
+
+		if (*c >= '0' && *c <= '9')
+			carry = *c - '0';
+		else if (base == 16 && *c >= 'a' && *c <= 'f')
+			carry = *c - 'a' + 10;
+		else if (base == 16 && *c >= 'A' && *c <= 'F')
+			carry = *c - 'A' + 10;
+		else
+			return 1;
+
+		for (i = 0; i < GP_ARRAY_SIZE(limbs); i++) {
+			carry += (uint64_t)limbs[i] * base;
+			limbs[i] = carry;
+			carry >>= 32;
+		}
+
+		if (carry)
+			return 1;
+	}
+
+	number[0] = limbs[0] | (uint64_t)limbs[1] << 32;
+	number[1] = limbs[2] | (uint64_t)limbs[3] << 32;
+
+	return 0;
+}
+
+/* Parse r<radius>:<number> for a rule number over the 2 * radius + 1
+ * neighbours, t<radius>:<code> for a totalistic rule or o<radius>:<code>
+ * for an outer totalistic one. Returns non-zero if it is none of those.
+ */
+static int parse_wide_rule(const char *str)
+{
+	enum ca1d_rule_kind kind;
+	uint64_t number[2];
+	unsigned int radius;
+
+	switch (str[0]) {
+	case 'r':
+		kind = CA1D_RULE_RADIUS;
+		break;
+	case 't':
+		kind = CA1D_RULE_TOTALISTIC;
+		break;
+	case 'o':
+		kind = CA1D_RULE_OUTER_TOTALISTIC;
+		break;
+	default:
+		return 1;
+	}
+
+	if (str[1] < '1' || str[1] > '9' || str[2] != ':' || parse_u128(str + 3, number))
+		return 1;
+
+	radius = str[1] - '0';
+
+	/* Radius one rule numbers are the elementary rules */
+	if (kind == CA1D_RULE_RADIUS && radius == 1) {
+		if (number[1] || number[0] > 255)
+			return 1;
+
+		rules[0] = number[0];
+		kind = CA1D_RULE_ELEMENTARY;
+	}
+
+	if (ca1d_wide_rule_set(kind, radius, number))
+		return 1;
+
+	rule_n = 1;
+
+	return 0;
+}
+
+/* Parse a wide rule or a list of elementary rules
+ *
+ * Returns non-zero, leaving the rules as they were, if it is neither.
+ */
+static int parse_rule_nums(const char *const rules_str)
+{
+	const char *c = rules_str;
+	uint8_t list[GP_ARRAY_SIZE(rules)];
 	uint8_t rule_acc = 0;
 	uint8_t rule_indx = 0;
 
-	while (*c) {
-		switch (*c) {
-		case '0' ... '9':
-			if (rule_acc > 25)
-				goto out;
+	if (!parse_wide_rule(rules_str))
+		return 0;
+
+	if (!*c || strspn(c, "0123456789,; ") != strlen(c))
+		return 1;
+
+	while (*c) {
+		switch (*c) {
+		case '0' ... '9':
+			if (rule_acc > 25 || (rule_acc == 25 && *c > '5'))
+				return 1;
+
+			rule_acc *= 10;
+			rule_acc += ((*c) - '0');
+			break;
+		case ',':
+		case ';':
+			/* rule_n has to fit the count */
+			if (rule_indx == GP_ARRAY_SIZE(list) - 2)
+				return 1;
+
+			list[rule_indx] = rule_acc;
+			rule_indx++;
+			rule_acc = 0;
+			break;
+		}
+
+		c++;
+	}
+
+	list[rule_indx] = rule_acc;
+	memcpy(rules, list, rule_indx + 1);
+	rule_n = rule_indx + 1;
+	wide_rule.kind = CA1D_RULE_ELEMENTARY;
+
+	return 0;
+}
+
+static const char *const boundary_names[] = {
+	[CA1D_BOUNDARY_PERIODIC] = "periodic",
+	[CA1D_BOUNDARY_ZERO] = "zero",
+	[CA1D_BOUNDARY_ONE] = "one",
+	[CA1D_BOUNDARY_REFLECT] = "reflect",
+};
+
+static int boundary_parse(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < GP_ARRAY_SIZE(boundary_names); i++) {
+		if (!strcmp(name, boundary_names[i])) {
+			boundary = i;
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+int rule_widget_on_event(gp_widget_event *ev)
+{
+	if (ev->type != GP_WIDGET_EVENT_WIDGET)
+		return 0;
+
+	switch(ev->self->type) {
+	case GP_WIDGET_TBOX:
+		switch(ev->sub_type) {
+		case GP_WIDGET_TBOX_PRE_FILTER:
+			switch ((char)ev->val) {
+			case '0' ... '9':
+			case ',':
+			case ';':
+			case 'r':
+			case 't':
+			case 'o':
+			case ':':
+			case 'x':
+			case 'a' ... 'f':
+			case 'A' ... 'F':
+			case 'S':
+			case 's':
+			case '/':
+				return 0;
+			}
+
+			return 1;
+		case GP_WIDGET_TBOX_EDIT:
+			gui_job_cancel();
+			if (ca2d)
+				ca2d_rule_parse(gp_widget_tbox_text(ev->self), &ca2d_bs);
+			else
+				parse_rule_nums(gp_widget_tbox_text(ev->self));
+			break;
+		default:
+			break;
+		}
+		break;
+	case GP_WIDGET_CHECKBOX:
+		gui_job_cancel();
+		reversible = gp_widget_bool_get(ev->self);
+		break;
+	default:
+		return 0;
+	}
+
+	pixmap_do_redraw();
+
+	return 0;
+}
+
+int meta_rule_widget_on_event(gp_widget_event *ev)
+{
+	if (ev->type != GP_WIDGET_EVENT_WIDGET)
+		return 0;
+
+	const char *text = gp_widget_tbox_text(ev->self);
+
+	switch(ev->self->type) {
+	case GP_WIDGET_TBOX:
+		switch(ev->sub_type) {
+		case GP_WIDGET_TBOX_PRE_FILTER:
+			switch ((char)ev->val) {
+			case '0' ... '9':
+				return 0;
+			}
+
+			return 1;
+		case GP_WIDGET_TBOX_EDIT:
+			gui_job_cancel();
+			meta_rule = (uint8_t)strtoul(text, NULL, 10);
+			break;
+		default:
+			break;
+		}
+		break;
+	default:
+		return 0;
+	}
+
+	pixmap_do_redraw();
+
+	return 0;
+}
+
+static void init_from_str(const char *text, size_t len)
+{
+	memset(init, 0, width * sizeof(uint64_t));
+	ca2d_generation = 0;
+
+	/* The step before the initial conditions was lost in scrubbing */
+	if (gui_time) {
+		memset(init_prev, 0, width * sizeof(uint64_t));
+		steps_done = 0;
+		gui_time = 0;
+		gui_time_show();
+	}
+
+	if (!len)
+		init[ca1d_cells() / 128] = 1UL << (63 - (ca1d_cells() / 2) % 64);
+	else
+		memcpy(init, text, GP_MIN(width * sizeof(uint64_t), len));
+
+	init[width - 1] &= ca1d_tail_mask();
+}
+
+static void init_from_text(void)
+{
+	gp_widget *self = gp_widget_by_uid(uids, "init", GP_WIDGET_TBOX);
+	const char *text = gp_widget_tbox_text(self);
+	size_t len = gp_vec_strlen(text);
+
+	init_from_str(text, len);
+}
+
+int width_widget_on_event(gp_widget_event *ev)
+{
+	size_t cells;
+	char c;
+
+	if (ev->type != GP_WIDGET_EVENT_WIDGET)
+		return 0;
+
+	const char *text = gp_widget_tbox_text(ev->self);
+
+	switch(ev->sub_type) {
+	case GP_WIDGET_TBOX_PRE_FILTER:
+		c = (char)ev->val;
+
+		return c < '0' || c > '9';
+
+		break;
+	case GP_WIDGET_TBOX_EDIT:
+		if (!text[0])
+			return 0;
+
+		if ((size_t)GP_MAX(1, strtol(text, NULL, 10)) == ca1d_cells())
+			return 0;
+
+		gui_job_cancel();
+		cells = ca1d_cells();
+		ca1d_cells_set(GP_MAX(1, strtol(text, NULL, 10)));
+		if (ca1d_allocate()) {
+			/* The rows are still the old width's */
+			ca1d_cells_set(cells);
+			gp_dialog_msg_printf_run(GP_DIALOG_MSG_ERR, "Resizing Failed",
+						 "%s", strerror(errno));
+		} else {
+			init_from_text();
+		}
+		pixmap_do_redraw();
+		break;
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+int height_widget_on_event(gp_widget_event *ev)
+{
+	size_t rows;
+	char c;
+
+	if (ev->type != GP_WIDGET_EVENT_WIDGET)
+		return 0;
+
+	const char *text = gp_widget_tbox_text(ev->self);
+
+	switch(ev->sub_type) {
+	case GP_WIDGET_TBOX_PRE_FILTER:
+		c = (char)ev->val;
+
+		return c < '0' || c > '9';
+
+		break;
+	case GP_WIDGET_TBOX_EDIT:
+		if (!text[0])
+			return 0;
+
+		if ((size_t)GP_MAX(2, strtol(text, NULL, 10)) == height)
+			return 0;
+
+		gui_job_cancel();
+		rows = height;
+		height = GP_MAX(2, strtol(text, NULL, 10));
+		if (ca1d_allocate()) {
+			height = rows;
+			gp_dialog_msg_printf_run(GP_DIALOG_MSG_ERR, "Resizing Failed",
+						 "%s", strerror(errno));
+		} else {
+			init_from_text();
+		}
+		pixmap_do_redraw();
+		break;
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+int init_widget_on_event(gp_widget_event *ev)
+{
+
+	if (ev->type != GP_WIDGET_EVENT_WIDGET)
+		return 0;
+
+	switch(ev->sub_type) {
+	case GP_WIDGET_TBOX_EDIT:
+		gui_job_cancel();
+		init_from_text();
+		pixmap_do_redraw();
+		break;
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+/* Scrub half a pixmap through time
+ *
+ * Reversible runs are stepped back from the first two rows, which can
+ * go before the initial conditions. Otherwise the earlier steps are
+ * evolved again from a copy of the initial conditions, which may have
+ * been loaded rather than typed. The view is just scrolled.
+ */
+static void gui_time_step(const int dir)
+{
+	int64_t by = dir * (int64_t)GP_MAX(height / 2, (size_t)1);
+	gp_pixmap *p;
+
+	if (ca2d)
+		return;
+
+	gui_job_cancel();
+
+	if (view.on) {
+		p = gp_widget_pixmap_get(gp_widget_by_uid(uids, "pixmap", GP_WIDGET_PIXMAP));
+		view_pan(p, 0, dir * (int32_t)GP_MAX(p->h / 2, 1U));
+		gui_time_show();
+		gui_job_start(p, 1);
+		return;
+	}
+
+	if (!gui_time)
+		memcpy(gui_init, init, width * sizeof(uint64_t));
+
+	if (by < 0 && !reversible) {
+		by = GP_MAX(gui_time + by, 0);
+		memcpy(init, gui_init, width * sizeof(uint64_t));
+		memset(init_prev, 0, width * sizeof(uint64_t));
+		gui_time = 0;
+	}
+
+	if (ca1d_pair_step(init_prev, init, by)) {
+		perror("Stepping failed");
+		return;
+	}
+
+	/* init_prev is not part of the steps' key */
+	steps_done = 0;
+	gui_time += by;
+	gui_time_show();
+	pixmap_do_redraw();
+}
+
+int time_back_on_event(gp_widget_event *ev)
+{
+	if (ev->type == GP_WIDGET_EVENT_WIDGET)
+		gui_time_step(-1);
+
+	return 0;
+}
+
+int time_forward_on_event(gp_widget_event *ev)
+{
+	if (ev->type == GP_WIDGET_EVENT_WIDGET)
+		gui_time_step(1);
+
+	return 0;
+}
+
+int save_on_event(gp_widget_event *ev)
+{
+	const char *path, *ext;
+	gp_dialog *dialog;
+	gp_widget *pixmap_w;
+	gp_pixmap *pixmap;
+
+	if (ev->type != GP_WIDGET_EVENT_WIDGET)
+		return 0;
+
+	dialog = gp_dialog_file_save_new(NULL, NULL);
+
+	if (gp_dialog_run(dialog) != GP_WIDGET_DIALOG_PATH)
+		return 0;
+
+	pixmap_w = gp_widget_by_uid(uids, "pixmap", GP_WIDGET_PIXMAP);
+	pixmap = gp_widget_pixmap_get(pixmap_w);
+	/* A 2D animation only ends when cancelled, which it is once the
+	 * generation it shows is shaded
+	 */
+	if (ca2d)
+		gui_job_cancel();
+	else
+		gui_job_wait();
+
+	path = gp_dialog_file_path(dialog);
+	ext = strrchr(path, '.');
+
+	if (ext && !strcasecmp(ext, ".ca1d") ? run_save(path) :
+	    gp_save_image(pixmap, path, NULL))
+		gp_dialog_msg_printf_run(GP_DIALOG_MSG_ERR, "Save Failed", "%s", strerror(errno));
+
+	gp_dialog_free(dialog);
+
+	if (ca2d)
+		gui_job_start(pixmap, 0);
+
+	return 0;
+}
+
+int widgets_main(int argc, char *argv[])
+{
+	gp_widget *layout = gp_app_layout_load("automata", &uids);
+
+	if (!layout)
+		return 0;
+
+	gp_widget *pixmap = gp_widget_by_uid(uids, "pixmap", GP_WIDGET_PIXMAP);
+	char rule[24];
+
+	if (ca2d) {
+		ca2d_rule_str(&ca2d_bs, rule);
+		gp_widget_tbox_set(gp_widget_by_uid(uids, "rule", GP_WIDGET_TBOX), rule);
+	}
+
+#ifdef CA1D_STATS
+	gui_stats_label = gp_widget_label_new("", 0, 0);
+	if (gui_stats_label) {
+		gui_stats_label->align = GP_HFILL | GP_VCENTER;
+		gp_widget_grid_put(gp_widget_by_uid(uids, "buttons", GP_WIDGET_GRID),
+				   1, 0, gui_stats_label);
+	}
+#endif
+
+	gp_widget_events_unmask(pixmap, GP_WIDGET_EVENT_RESIZE);
+	gp_widget_events_unmask(pixmap, GP_WIDGET_EVENT_INPUT);
+	gp_widgets_timer_ins(&gui_redraw_timer);
+	gp_widgets_main_loop(layout, NULL, argc, argv);
+}
+
+/* Writes each row's bitfields to a file in native byte order */
+static int raw_sink_row(struct ca1d_sink *self, const uint64_t *row, size_t i)
+{
+	(void)i;
+
+	if (fwrite(row, sizeof(uint64_t), width, self->priv) == width)
+		return 0;
+
+	perror("Writing rows failed");
+	return 1;
+}
+
+static struct ca1d_sink raw_sink = {
+	.row = raw_sink_row,
+};
+
+/* Accumulates the population, i.e. number of live cells, of the rows */
+struct row_stats {
+	size_t rows;
+	uint64_t pop_min;
+	uint64_t pop_max;
+	uint64_t pop_sum;
+	uint64_t pop_last;
+};
+
+static int stats_sink_row(struct ca1d_sink *self, const uint64_t *row, size_t i)
+{
+	struct row_stats *stats = self->priv;
+	uint64_t pop = 0;
+	size_t j;
+
+	for (j = 0; j < width; j++)
+		pop += pop_count(row[j]);
+
+	if (!i || pop < stats->pop_min)
+		stats->pop_min = pop;
+	if (pop > stats->pop_max)
+		stats->pop_max = pop;
+
+	stats->pop_sum += pop;
+	stats->pop_last = pop;
+	stats->rows++;
+
+	return 0;
+}
+
+static struct row_stats row_stats;
+
+static struct ca1d_sink stats_sink = {
+	.row = stats_sink_row,
+	.priv = &row_stats,
+};
+
+static void stats_print(const struct row_stats *stats)
+{
+	const double cells = ca1d_cells();
+
+	printf("Rows %zu\n", stats->rows);
+	printf("Population min %lu max %lu last %lu\n",
+	       stats->pop_min, stats->pop_max, stats->pop_last);
+	printf("Mean density %f\n",
+	       stats->rows ? stats->pop_sum / (cells * stats->rows) : 0);
+}
+
+/* Most memory in bytes kept for the rows of a cycle */
+#define CYCLE_KEEP_BYTES (1UL << 25)
+
+/* Detects a cycle in the rows passed on to the sinks in out
+ *
+ * The last keep rows are kept so that a repeat can be verified and
+ * the rows after it replayed from the cycle. Once a state repeats within
+ * them the simulation stops. A longer cycle is only reported.
+ */
+struct cycle_sink {
+	struct ca1d_cycle cycle;
+	struct ca1d_sink *out;
+	uint64_t *kept;
+	size_t keep;
+	size_t transient;
+	size_t period;
+	/* The cycle was found and the rows after it can be replayed */
+	int stopped;
+	/* A sink in out failed */
+	int failed;
+};
+
+static uint64_t *cycle_kept(struct cycle_sink *self, const size_t i)
+{
+	return self->kept + gp_matrix_idx(width, i % self->keep, 0);
+}
+
+static int cycle_sink_row(struct ca1d_sink *sink, const uint64_t *row, size_t i)
+{
+	struct cycle_sink *self = sink->priv;
+	const size_t bytes = width * sizeof(uint64_t);
+	size_t j;
+
+	if (ca1d_sink_row(self->out, row, i)) {
+		self->failed = 1;
+		return 1;
+	}
+
+	if (self->period)
+		return 0;
+
+	memcpy(cycle_kept(self, i), row, bytes);
+	j = ca1d_cycle_step(&self->cycle, row, i, reversible);
+
+	if (j == SIZE_MAX)
+		return 0;
+
+	if (i - j + 1 >= self->keep) {
+		self->transient = j;
+		self->period = i - j;
+		return 0;
+	}
+
+	if (memcmp(cycle_kept(self, j), row, bytes))
+		return 0;
+
+	if (reversible && memcmp(j ? cycle_kept(self, j - 1) : init_prev,
+				 cycle_kept(self, i - 1), bytes))
+		return 0;
+
+	self->transient = j;
+	self->period = i - j;
+	self->stopped = 1;
+
+	return 1;
+}
+
+static struct cycle_sink cycle_state;
+
+static struct ca1d_sink cycle_sink = {
+	.row = cycle_sink_row,
+	.priv = &cycle_state,
+};
+
+static int cycle_sink_init(struct cycle_sink *self, struct ca1d_sink *out)
+{
+	self->out = out;
+	self->keep = GP_MAX(2UL, GP_MIN(height, CYCLE_KEEP_BYTES / (width * sizeof(uint64_t))));
+	self->kept = gp_matrix_new(width, self->keep, sizeof(uint64_t));
+
+	if (!self->kept)
+		return 1;
+
+	if (ca1d_cycle_init(&self->cycle)) {
+		gp_vec_free(self->kept);
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Pass the rows after the cycle was found to the sinks, copying them
+ * from the cycle instead of evolving them
+ */
+static int cycle_replay(struct cycle_sink *self)
+{
+	size_t i;
+
+	for (i = self->transient + self->period + 1; i < height; i++) {
+		uint64_t *row = cycle_kept(self, i);
+
+		memcpy(row, cycle_kept(self, i - self->period),
+		       width * sizeof(uint64_t));
+
+		if (!streaming)
+			memcpy(ca1d_row(i), row, width * sizeof(uint64_t));
+
+		if (ca1d_sink_row(self->out, row, i))
+			return 1;
+	}
+
+	return 0;
+}
+
+static void cycle_print(const struct cycle_sink *self)
+{
+	if (self->period)
+		printf("Cycle transient %zu period %zu\n", self->transient, self->period);
+	else
+		printf("No cycle within %zu rows\n", height);
+}
+
+/* Seconds between checkpoints unless set with -p */
+#define CHECKPOINT_SECS 60
+
+/* A checkpoint is this header followed by the last step written and the
+ * one before it. Everything is little endian.
+ */
+struct checkpoint_header {
+	char magic[8];
+	uint64_t width;
+	/* Steps in the whole run */
+	uint64_t height;
+	/* The last step given to the sinks */
+	uint64_t step;
+	/* Length of the raw rows file, zero if it is not a file */
+	uint64_t raw_bytes;
+	/* The population statistics so far */
+	uint64_t rows;
+	uint64_t pop_min;
+	uint64_t pop_max;
+	uint64_t pop_sum;
+	uint64_t pop_last;
+	uint8_t rules[256];
+	uint8_t rule_n;
+	uint8_t meta_rule;
+	uint8_t reversible;
+	/* As in struct run_header */
+	uint8_t tail;
+	uint8_t boundary;
+	uint8_t kind;
+	uint8_t radius;
+	uint8_t pad[1];
+};
+
+#define CHECKPOINT_MAGIC "CA1DCKP1"
+
+/* Periodically saves the state needed to continue the run
+ *
+ * The rows are passed on to the sinks in out first, so a checkpoint
+ * never refers to output which has not been written yet. When resuming
+ * the steps are offset by from, the step in the checkpoint, and that
+ * step is not given to the sinks again.
+ */
+struct checkpoint {
+	const char *path;
+	struct ca1d_sink *out;
+	size_t from;
+	/* Steps in the whole run */
+	size_t total;
+	/* Copy of step prev_i, kept when a checkpoint is due at the next */
+	uint64_t *prev;
+	size_t prev_i;
+	/* The two steps being written */
+	uint64_t *words;
+	unsigned int period;
+	struct timespec last;
+	FILE *raw;
+	struct row_stats *stats;
+};
+
+static int checkpoint_write(struct checkpoint *self, const uint64_t *row,
+			    const size_t i)
+{
+	const size_t row_bytes = width * sizeof(uint64_t);
+	char tmp[strlen(self->path) + 5];
+	struct checkpoint_header h = { .rows = 0 };
+	uint64_t *words;
+	FILE *f;
+	int ret;
+
+	if (self->raw) {
+		off_t len;
+
+		if (fflush(self->raw) || fsync(fileno(self->raw)))
+			return 1;
+
+		len = ftello(self->raw);
+		h.raw_bytes = htole64(len < 0 ? 0 : len);
+	}
+
+	memcpy(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic));
+	h.width = htole64(width);
+	h.height = htole64(self->total);
+	h.step = htole64(i);
+	if (self->stats) {
+		h.rows = htole64(self->stats->rows);
+		h.pop_min = htole64(self->stats->pop_min);
+		h.pop_max = htole64(self->stats->pop_max);
+		h.pop_sum = htole64(self->stats->pop_sum);
+		h.pop_last = htole64(self->stats->pop_last);
+	}
+	header_rules_set(h.rules, &h.kind, &h.radius);
+	h.rule_n = rule_n;
+	h.meta_rule = meta_rule;
+	h.reversible = reversible;
+	h.tail = tail % 64;
+	h.boundary = boundary;
+
+	words = self->words;
+	run_words_to_le(words, self->prev, width);
+	run_words_to_le(words + width, row, width);
+
+	/* Replacing the old checkpoint with rename is atomic */
+	sprintf(tmp, "%s.tmp", self->path);
+	f = fopen(tmp, "wb");
+	if (!f)
+		return 1;
+
+	ret = fwrite(&h, sizeof(h), 1, f) != 1;
+	ret = ret || fwrite(words, row_bytes, 2, f) != 2;
+	ret = ret || fflush(f) || fsync(fileno(f));
+	ret = fclose(f) || ret;
+	ret = ret || rename(tmp, self->path);
+
+	if (ret)
+		unlink(tmp);
+
+	return ret;
+}
+
+static int checkpoint_sink_row(struct ca1d_sink *sink, const uint64_t *row, size_t i)
+{
+	struct checkpoint *self = sink->priv;
+	struct timespec now;
+
+	if (self->from && !i)
+		return 0;
+
+	i += self->from;
+
+	if (ca1d_sink_row(self->out, row, i))
+		return 1;
+
+	if (self->prev_i + 1 == i) {
+		if (checkpoint_write(self, row, i))
+			perror("Writing checkpoint failed");
+
+		clock_gettime(CLOCK_MONOTONIC, &self->last);
+	}
+
+	/* The time is only checked now and then, the last step is always
+	 * checkpointed so that resuming a finished run does nothing.
+	 */
+	if (i + 2 != self->total) {
+		if (i & 63)
+			return 0;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (now.tv_sec - self->last.tv_sec < self->period)
+			return 0;
+	}
+
+	memcpy(self->prev, row, width * sizeof(uint64_t));
+	self->prev_i = i;
+
+	return 0;
+}
+
+static struct checkpoint checkpoint;
+
+static struct ca1d_sink checkpoint_sink = {
+	.row = checkpoint_sink_row,
+	.priv = &checkpoint,
+};
+
+static int checkpoint_init(struct checkpoint *self, struct ca1d_sink *out,
+			   FILE *raw, struct row_stats *stats)
+{
+	struct stat st;
+
+	self->out = out;
+	self->total = self->from + height;
+	self->prev_i = SIZE_MAX - 1;
+	self->raw = raw && !fstat(fileno(raw), &st) && S_ISREG(st.st_mode) ? raw : NULL;
+	self->stats = stats;
+	self->prev = gp_vec_new(width, sizeof(uint64_t));
+	self->words = gp_vec_new(2 * width, sizeof(uint64_t));
+	clock_gettime(CLOCK_MONOTONIC, &self->last);
+
+	return !self->prev || !self->words;
+}
+
+/* Read a checkpoint's header and take the rules and size from it
+ *
+ * Returns the file positioned at the rows, or NULL with errno set.
+ */
+static FILE *checkpoint_open(const char *path, struct checkpoint_header *h)
+{
+	FILE *f = fopen(path, "rb");
+
+	if (!f)
+		return NULL;
+
+	if (fread(h, sizeof(*h), 1, f) != 1 ||
+	    memcmp(h->magic, CHECKPOINT_MAGIC, sizeof(h->magic))) {
+		fclose(f);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	h->width = le64toh(h->width);
+	h->height = le64toh(h->height);
+	h->step = le64toh(h->step);
+	h->raw_bytes = le64toh(h->raw_bytes);
+	h->rows = le64toh(h->rows);
+	h->pop_min = le64toh(h->pop_min);
+	h->pop_max = le64toh(h->pop_max);
+	h->pop_sum = le64toh(h->pop_sum);
+	h->pop_last = le64toh(h->pop_last);
+
+	if (!h->width || h->width > SIZE_MAX / 16 || h->step >= h->height ||
+	    h->tail >= 64 || h->boundary > CA1D_BOUNDARY_REFLECT || !h->rule_n ||
+	    header_rules_check(h->rules, h->kind, h->radius)) {
+		fclose(f);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	width = h->width;
+	tail = h->tail ? h->tail : 64;
+	boundary = h->boundary;
+	height = h->height - h->step;
+	header_rules_get(h->rules, h->kind, h->radius);
+	rule_n = h->rule_n;
+	meta_rule = h->meta_rule;
+	reversible = h->reversible;
+
+	return f;
+}
+
+/* Read the checkpoint's steps into init_prev and init, then close it */
+static int checkpoint_rows(FILE *f)
+{
+	const size_t row_bytes = width * sizeof(uint64_t);
+	int ret = fread(init_prev, row_bytes, 1, f) != 1 ||
+		  fread(init, row_bytes, 1, f) != 1;
+
+	fclose(f);
+
+	if (ret) {
+		errno = EINVAL;
+		return 1;
+	}
+
+	run_words_from_le(init_prev, init_prev, width);
+	run_words_from_le(init, init, width);
+
+	if (!reversible)
+		memset(init_prev, 0, width * sizeof(uint64_t));
+
+	return 0;
+}
+
+/* Writes the rows out as an image, one scanline at a time
+ *
+ * Pixel (x, y) shows cell x * pw of row y * ph, the same as shade_pixel,
+ * so the image is identical to one rendered from the whole pixmap.
+ */
+struct image_writer {
+	int (*line)(struct image_writer *self);
+	int (*finish)(struct image_writer *self);
+	FILE *f;
+	uint32_t w, h;
+	float pw, ph;
+	/* How many pixels each cell covers if it is a whole number, or 0 */
+	unsigned int k;
+	/* The next scanline to write */
+	uint32_t y;
+	/* XORed onto the scanline, set when a live cell is a zero bit */
+	uint8_t invert;
+	/* One bit per pixel with the leftmost in the most significant bit */
+	uint8_t *line_buf;
+#ifdef HAVE_LIBPNG
+	png_structp png;
+	png_infop png_info;
+#endif
+};
+
+static void image_scanline(struct image_writer *self, const uint64_t *row)
+{
+	const size_t len = (self->w + 7) / 8;
+	uint32_t x;
+
+	if (self->k) {
+		row_to_bits(row, self->line_buf, len, self->k);
+		goto out;
+	}
+
+	memset(self->line_buf, 0, len);
+
+	for (x = 0; x < self->w; x++) {
+		const size_t i = (float)x * self->pw;
+		const uint8_t bit = (row[i >> 6] >> (63 - (i & 63))) & 1;
+
+		self->line_buf[x >> 3] |= bit << (7 - (x & 7));
+	}
+
+out:
+	for (x = 0; x < len; x++)
+		self->line_buf[x] ^= self->invert;
+}
+
+static int image_sink_row(struct ca1d_sink *self, const uint64_t *row, size_t i)
+{
+	struct image_writer *img = self->priv;
+	const int last = i + 1 >= height;
+
+	while (img->y < img->h) {
+		const size_t j = (float)img->y * img->ph;
+
+		if (j > i && !last)
+			break;
+
+		image_scanline(img, row);
+
+		if (img->line(img))
+			return 1;
+
+		img->y++;
+	}
+
+	return 0;
+}
+
+static int pbm_line(struct image_writer *self)
+{
+	const size_t len = (self->w + 7) / 8;
+
+	return fwrite(self->line_buf, 1, len, self->f) != len;
+}
+
+static int image_finish(struct image_writer *self)
+{
+	int ret = fclose(self->f);
+
+	free(self->line_buf);
+
+	return ret;
+}
+
+static int pbm_start(struct image_writer *self)
+{
+	self->line = pbm_line;
+	self->finish = image_finish;
+
+	return fprintf(self->f, "P4\n%u %u\n", self->w, self->h) < 0;
+}
+
+#ifdef HAVE_LIBPNG
+static int png_line(struct image_writer *self)
+{
+	if (setjmp(png_jmpbuf(self->png)))
+		return 1;
+
+	png_write_row(self->png, self->line_buf);
+
+	return 0;
+}
+
+static int png_end(struct image_writer *self)
+{
+	if (setjmp(png_jmpbuf(self->png)))
+		return 1;
+
+	png_write_end(self->png, NULL);
+
+	return 0;
+}
+
+static int png_finish(struct image_writer *self)
+{
+	int ret = png_end(self);
+
+	png_destroy_write_struct(&self->png, &self->png_info);
+
+	return image_finish(self) || ret;
+}
+
+static int png_start(struct image_writer *self)
+{
+	self->png = png_create_write_struct(PNG_LIBPNG_VER_STRING,
+					    NULL, NULL, NULL);
+	if (!self->png)
+		return 1;
+
+	self->png_info = png_create_info_struct(self->png);
+	if (!self->png_info) {
+		png_destroy_write_struct(&self->png, NULL);
+		return 1;
+	}
+
+	if (setjmp(png_jmpbuf(self->png))) {
+		png_destroy_write_struct(&self->png, &self->png_info);
+		return 1;
+	}
+
+	/* In grayscale a zero is black, the color of a live cell */
+	self->invert = 0xff;
+	self->line = png_line;
+	self->finish = png_finish;
+
+	png_init_io(self->png, self->f);
+	png_set_IHDR(self->png, self->png_info, self->w, self->h, 1,
+		     PNG_COLOR_TYPE_GRAY, PNG_INTERLACE_NONE,
+		     PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+	png_write_info(self->png, self->png_info);
+
+	return 0;
+}
+#endif
+
+static const struct image_format {
+	const char *ext;
+	int (*start)(struct image_writer *self);
+} image_formats[] = {
+	{".pbm", pbm_start},
+#ifdef HAVE_LIBPNG
+	{".png", png_start},
+#endif
+};
+
+/* The streamed format with the extension, or NULL */
+static const struct image_format *image_format_find(const char *ext)
+{
+	size_t i;
+
+	for (i = 0; ext && i < GP_ARRAY_SIZE(image_formats); i++) {
+		if (!strcasecmp(ext, image_formats[i].ext))
+			return &image_formats[i];
+	}
+
+	return NULL;
+}
+
+/* Start writing an image in the format to f, which finish closes */
+static int image_writer_start(struct image_writer *self, FILE *f,
+			      const struct image_format *fmt, float scale)
+{
+	self->w = ca1d_cells() * scale;
+	self->h = height * scale;
+	self->pw = 1.0f / scale;
+	self->ph = 1.0f / scale;
+	self->k = self->w % ca1d_cells() ? 0 : self->w / ca1d_cells();
+	self->y = 0;
+	self->invert = 0;
+
+	if (self->k && row_bits_prepare(self->k))
+		return 1;
+
+	self->line_buf = malloc((self->w + 7) / 8);
+	if (!self->line_buf)
+		return 1;
+
+	self->f = f;
+	if (!fmt->start(self))
+		return 0;
+
+	free(self->line_buf);
+	return 1;
+}
+
+/* Start writing an image to path if the format can be streamed
+ *
+ * Returns non-zero and sets errno to ENOSYS if the format needs the
+ * whole pixmap.
+ */
+static int image_writer_open(struct image_writer *self,
+			     const char *path, float scale)
+{
+	const struct image_format *fmt = image_format_find(strrchr(path, '.'));
+	FILE *f;
+
+	if (!fmt) {
+		errno = ENOSYS;
+		return 1;
+	}
+
+	f = fopen(path, "wb");
+	if (!f)
+		return 1;
+
+	if (!image_writer_start(self, f, fmt, scale))
+		return 0;
+
+	fclose(f);
+	return 1;
+}
+
+static struct image_writer image_writer;
+
+static struct ca1d_sink image_sink = {
+	.row = image_sink_row,
+	.priv = &image_writer,
+};
+
+#ifdef HAVE_GLES
+/* The GPU backend evolves and renders headless images with OpenGL ES
+ * 3.1 compute shaders, on a surfaceless EGL display so that no window
+ * system is needed.
+ *
+ * A band of rows is kept on the device, each segment being a uvec2 of
+ * its low and high 32 bits. Every step is a dispatch with an invocation
+ * per segment, or a single dispatch of one work group for all the steps
+ * of the band when the row fits in it. The band's scanlines are then
+ * shaded on the device and only they are read back into the pixmap.
+ * The last two rows are copied to the start for the next band.
+ *
+ * The shaders mirror the CPU engine exactly, which stays the reference.
+ * Only the elementary rules, alternating or chosen by a meta rule, are
+ * supported.
+ */
+
+/* Invocations per work group, the least every implementation has */
+#define GPU_GROUP 128
+
+/* Steps evolved by one dispatch when a work group covers the row, a
+ * limit so that no dispatch runs for long enough to trip a watchdog
+ */
+#define GPU_GROUP_STEPS 4096
+
+/* Bytes of rows and of scanlines kept on the device at a time */
+#define GPU_BAND_BYTES (64UL << 20)
+#define GPU_IMAGE_BYTES (16UL << 20)
+
+static const char gpu_step_src[] =
+	"#version 310 es\n"
+	"layout(local_size_x = 128) in;\n"
+	"layout(std430, binding = 0) buffer Rows { uvec2 rows[]; };\n"
+	"layout(std430, binding = 1) readonly buffer Rules { uint rules[]; };\n"
+	"uniform uint width, tail, boundary, rule_n, meta_rule, reversible;\n"
+	"/* The row evolved first and how many steps follow it */\n"
+	"uniform uint row, steps;\n"
+	"\n"
+	"uvec2 rotl(uvec2 a, uint n)\n"
+	"{\n"
+	"	n &= 63u;\n"
+	"	if (n >= 32u) { a = a.yx; n -= 32u; }\n"
+	"	if (n == 0u) return a;\n"
+	"	return uvec2((a.x << n) | (a.y >> (32u - n)), (a.y << n) | (a.x >> (32u - n)));\n"
+	"}\n"
+	"\n"
+	"uvec2 shl(uint n)\n"
+	"{\n"
+	"	return n >= 32u ? uvec2(0u, 1u << (n - 32u)) : uvec2(1u << n, 0u);\n"
+	"}\n"
+	"\n"
+	"int pop(uvec2 a) { return bitCount(a.x) + bitCount(a.y); }\n"
+	"\n"
+	"uvec2 edge_left(uint b)\n"
+	"{\n"
+	"	if (boundary == 1u) return uvec2(0u);\n"
+	"	if (boundary == 2u) return uvec2(~0u);\n"
+	"	if (boundary == 3u) return rotl(rows[b], 1u);\n"
+	"	return rotl(rows[b + width - 1u], tail);\n"
+	"}\n"
+	"\n"
+	"uvec2 edge_right(uint b)\n"
+	"{\n"
+	"	if (boundary == 1u) return uvec2(0u);\n"
+	"	if (boundary == 2u) return uvec2(~0u);\n"
+	"	if (boundary == 3u) return rotl(rows[b + width - 1u], tail - 1u);\n"
+	"	return rows[b];\n"
+	"}\n"
+	"\n"
+	"/* The rule's truth table as a sum of its minterms */\n"
+	"uvec2 apply(uint rule, uvec2 l, uvec2 c, uvec2 r)\n"
+	"{\n"
+	"	uvec2 o = uvec2(0u);\n"
+	"	for (uint k = 0u; k < 8u; k++) {\n"
+	"		if (((rule >> k) & 1u) == 0u) continue;\n"
+	"		o |= ((k & 4u) != 0u ? l : ~l) & ((k & 2u) != 0u ? c : ~c) &\n"
+	"		     ((k & 1u) != 0u ? r : ~r);\n"
+	"	}\n"
+	"	return o;\n"
+	"}\n"
+	"\n"
+	"void evolve(uint b, uint i)\n"
+	"{\n"
+	"	uvec2 c = rows[b + i];\n"
+	"	uvec2 left = i > 0u ? rows[b + i - 1u] : edge_left(b);\n"
+	"	uvec2 right = i + 1u < width ? rows[b + i + 1u] : edge_right(b);\n"
+	"	uint rule = rules[i % rule_n];\n"
+	"	if (meta_rule != 0u) {\n"
+	"		uint m = (pop(left) > 32 ? 4u : 0u) | (pop(c) > 32 ? 2u : 0u) | (pop(right) > 32 ? 1u : 0u);\n"
+	"		rule = rules[(meta_rule >> m) & 1u];\n"
+	"	}\n"
+	"	bool last = i + 1u == width;\n"
+	"	if (last && tail < 64u && (right.y >> 31) != 0u) c |= shl(63u - tail);\n"
+	"	uvec2 l = uvec2((c.x >> 1) | (c.y << 31), (c.y >> 1) | (left.x << 31));\n"
+	"	uvec2 r = uvec2((c.x << 1) | (right.y >> 31), (c.y << 1) | (c.x >> 31));\n"
+	"	uvec2 o = apply(rule, l, c, r);\n"
+	"	if (reversible != 0u) o ^= rows[b - width + i];\n"
+	"	if (last && tail < 64u) {\n"
+	"		uint s = 64u - tail;\n"
+	"		o &= s >= 32u ? uvec2(0u, ~0u << (s - 32u)) : uvec2(~0u << s, ~0u);\n"
+	"	}\n"
+	"	rows[b + width + i] = o;\n"
+	"}\n"
+	"\n"
+	"void main()\n"
+	"{\n"
+	"	uint i = gl_GlobalInvocationID.x;\n"
+	"	for (uint s = 0u; s < steps; s++) {\n"
+	"		if (i < width) evolve((row + s) * width, i);\n"
+	"		memoryBarrierBuffer();\n"
+	"		barrier();\n"
+	"	}\n"
+	"}\n";
+
+static const char gpu_shade_src[] =
+	"#version 310 es\n"
+	"layout(local_size_x = 128) in;\n"
+	"layout(std430, binding = 0) readonly buffer Rows { uvec2 rows[]; };\n"
+	"layout(std430, binding = 2) writeonly buffer Image { uint image[]; };\n"
+	"uniform uint width, pixels, line_words, lines, y0, k, msb_first;\n"
+	"/* The step in the band's first row */\n"
+	"uniform int row0;\n"
+	"uniform uint live, dead;\n"
+	"uniform float pw, ph;\n"
+	"\n"
+	"void main()\n"
+	"{\n"
+	"	uint q = gl_GlobalInvocationID.x % line_words;\n"
+	"	uint y = gl_GlobalInvocationID.x / line_words;\n"
+	"	if (y >= lines) return;\n"
+	"	uint b = uint(int(uint(float(y0 + y) * ph)) - row0) * width;\n"
+	"	uint o = 0u;\n"
+	"	for (uint x = 0u; x < 32u && 32u * q + x < pixels; x++) {\n"
+	"		uint px = 32u * q + x;\n"
+	"		uint i = k != 0u ? px / k : uint(float(px) * pw);\n"
+	"		uvec2 c = rows[b + i / 64u];\n"
+	"		uint n = 63u - i % 64u;\n"
+	"		uint v = ((n >= 32u ? c.y >> (n - 32u) : c.x >> n) & 1u) != 0u ? live : dead;\n"
+	"		o |= v << (x & ~7u) << (msb_first != 0u ? 7u - (x & 7u) : x & 7u);\n"
+	"	}\n"
+	"	image[y * line_words + q] = o;\n"
+	"}\n";
+
+static struct gpu {
+	int ready, failed;
+	EGLDisplay display;
+	EGLContext context;
+	GLuint step, shade;
+	/* The band of rows, rule table and scanlines */
+	GLuint bufs[3];
+} gpu_state;
+
+static GLuint gpu_program(const char *src)
+{
+	GLuint shader = glCreateShader(GL_COMPUTE_SHADER);
+	GLuint prog = glCreateProgram();
+	GLint ok;
+	char log[1024];
+
+	glShaderSource(shader, 1, &src, NULL);
+	glCompileShader(shader);
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+	if (!ok) {
+		glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+		fprintf(stderr, "Compiling shader failed: %s\n", log);
+		return 0;
+	}
+
+	glAttachShader(prog, shader);
+	glLinkProgram(prog);
+	glDeleteShader(shader);
+	glGetProgramiv(prog, GL_LINK_STATUS, &ok);
+	if (!ok) {
+		glGetProgramInfoLog(prog, sizeof(log), NULL, log);
+		fprintf(stderr, "Linking shader failed: %s\n", log);
+		return 0;
+	}
+
+	return prog;
+}
+
+/* Create the context and programs the first time, returns non-zero if
+ * there is no usable GPU
+ */
+static int gpu_init(struct gpu *self)
+{
+	static const EGLint attrs[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 3,
+		EGL_CONTEXT_MINOR_VERSION, 1,
+		EGL_NONE
+	};
+	PFNEGLGETPLATFORMDISPLAYEXTPROC get_display =
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+
+	if (self->ready || self->failed)
+		return self->failed;
+
+	self->failed = 1;
+
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+	self->display = get_display ?
+		get_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL) :
+		eglGetDisplay(EGL_DEFAULT_DISPLAY);
+#else
+	(void)get_display;
+	self->display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+#endif
+
+	if (self->display == EGL_NO_DISPLAY || !eglInitialize(self->display, NULL, NULL) ||
+	    !eglBindAPI(EGL_OPENGL_ES_API)) {
+		fprintf(stderr, "Initialising EGL failed: 0x%x\n", eglGetError());
+		return 1;
+	}
+
+	self->context = eglCreateContext(self->display, EGL_NO_CONFIG_KHR,
+					 EGL_NO_CONTEXT, attrs);
+	if (self->context == EGL_NO_CONTEXT ||
+	    !eglMakeCurrent(self->display, EGL_NO_SURFACE, EGL_NO_SURFACE, self->context)) {
+		fprintf(stderr, "Creating an OpenGL ES 3.1 context failed: 0x%x\n", eglGetError());
+		return 1;
+	}
+
+	self->step = gpu_program(gpu_step_src);
+	self->shade = gpu_program(gpu_shade_src);
+	if (!self->step || !self->shade)
+		return 1;
+
+	glGenBuffers(GP_ARRAY_SIZE(self->bufs), self->bufs);
+	self->ready = 1;
+	self->failed = 0;
+
+	return 0;
+}
+
+static void gpu_uniform(const GLuint prog, const char *name, const GLuint val)
+{
+	glUniform1ui(glGetUniformLocation(prog, name), val);
+}
+
+/* Allocate the buffer and upload size bytes of data to it, if not NULL */
+static void gpu_buffer(const GLuint buf, const GLuint binding,
+		       const size_t size, const void *data)
+{
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, buf);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, size, data, GL_DYNAMIC_COPY);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, buf);
+}
+
+/* Upload a row as the low and high halves of each segment */
+static int gpu_row_put(const size_t r, const uint64_t *row)
+{
+	uint32_t *words = malloc(width * 8);
+	size_t i;
+
+	if (!words)
+		return 1;
+
+	for (i = 0; i < width; i++) {
+		words[2 * i] = row[i];
+		words[2 * i + 1] = row[i] >> 32;
+	}
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpu_state.bufs[0]);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, r * width * 8, width * 8, words);
+	free(words);
+
+	return 0;
+}
+
+/* Evolve steps steps after band row r
+ *
+ * A row which fits in one work group is evolved several steps per
+ * dispatch, synchronised by the work group's barrier. Otherwise each
+ * step is a dispatch of its own.
+ */
+static void gpu_steps(const size_t r, const size_t steps)
+{
+	const GLuint prog = gpu_state.step;
+	const size_t per = width <= GPU_GROUP ? GPU_GROUP_STEPS : 1;
+	const GLuint groups = (width + GPU_GROUP - 1) / GPU_GROUP;
+	size_t s;
+
+	glUseProgram(prog);
+
+	for (s = 0; s < steps; s += per) {
+		gpu_uniform(prog, "row", r + s);
+		gpu_uniform(prog, "steps", GP_MIN(per, steps - s));
+		glDispatchCompute(groups, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+	}
+}
+
+/* Shade the pixmap's scanlines [y0, y1), whose rows start at the band
+ * row showing step row0, and copy them into the pixmap
+ */
+static int gpu_shade(gp_pixmap *p, const uint32_t y0, const uint32_t y1,
+		     const GLint row0)
+{
+	const GLuint prog = gpu_state.shade;
+	const size_t line_words = (p->w + 31) / 32;
+	const size_t line_bytes = (p->w + 7) / 8;
+	const uint8_t *image;
+	uint32_t y;
+
+	glUseProgram(prog);
+	gpu_uniform(prog, "lines", y1 - y0);
+	gpu_uniform(prog, "y0", y0);
+	glUniform1i(glGetUniformLocation(prog, "row0"), row0);
+	glDispatchCompute((line_words * (y1 - y0) + GPU_GROUP - 1) / GPU_GROUP, 1, 1);
+	glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpu_state.bufs[2]);
+	image = glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0,
+				 line_words * 4 * (y1 - y0), GL_MAP_READ_BIT);
+	if (!image) {
+		errno = EIO;
+		return 1;
+	}
+
+	for (y = y0; y < y1; y++) {
+		memcpy(p->pixels + (size_t)y * p->bytes_per_row,
+		       image + (y - y0) * line_words * 4, line_bytes);
+	}
+
+	glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+
+	return 0;
+}
+
+/* Evolve the rows from init and init_prev and render them to the G1
+ * pixmap p with pixel (x, y) showing the cell x * pw of row y * ph, as
+ * render_pixmap does
+ *
+ * Returns non-zero with errno set on failure, ENOTSUP for rules the GPU
+ * does not evolve and ENODEV when there is no GPU.
+ */
+static int gpu_render(gp_pixmap *p, const float pw, const float ph,
+		      const gp_pixel bg, const gp_pixel fg)
+{
+	const size_t cells = ca1d_cells();
+	const size_t line_words = (p->w + 31) / 32;
+	const size_t band = GP_MAX(2UL, GP_MIN(height, GPU_BAND_BYTES / (8 * width)));
+	const uint32_t batch = GP_MAX(1UL, GPU_IMAGE_BYTES / (4 * line_words));
+	GLuint table[256], step, shade;
+	size_t first = 0, n, i;
+	uint32_t y = 0, y1;
+
+	if (wide_rule.kind != CA1D_RULE_ELEMENTARY || p->pixel_type != GP_PIXEL_G1) {
+		errno = ENOTSUP;
+		return 1;
+	}
+
+	if (gpu_init(&gpu_state)) {
+		errno = ENODEV;
+		return 1;
+	}
+
+	step = gpu_state.step;
+	shade = gpu_state.shade;
+
+	/* The meta rule reads the second rule even if there is only one */
+	for (i = 0; i < ca1d_rules_used(); i++)
+		table[i] = rules[i];
+
+	gpu_buffer(gpu_state.bufs[0], 0, (band + 2) * width * 8, NULL);
+	gpu_buffer(gpu_state.bufs[1], 1, ca1d_rules_used() * sizeof(*table), table);
+	gpu_buffer(gpu_state.bufs[2], 2, GP_MIN((size_t)p->h, (size_t)batch) * line_words * 4, NULL);
+
+	glUseProgram(step);
+	gpu_uniform(step, "width", width);
+	gpu_uniform(step, "tail", tail);
+	gpu_uniform(step, "boundary", boundary);
+	gpu_uniform(step, "rule_n", rule_n);
+	gpu_uniform(step, "meta_rule", meta_rule);
+	gpu_uniform(step, "reversible", reversible);
+
+	glUseProgram(shade);
+	gpu_uniform(shade, "width", width);
+	gpu_uniform(shade, "pixels", p->w);
+	gpu_uniform(shade, "line_words", line_words);
+	gpu_uniform(shade, "k", p->w % cells ? 0 : p->w / cells);
+	gpu_uniform(shade, "msb_first", g1_msb_first());
+	gpu_uniform(shade, "live", fg & 1);
+	gpu_uniform(shade, "dead", bg & 1);
+	glUniform1f(glGetUniformLocation(shade, "pw"), pw);
+	glUniform1f(glGetUniformLocation(shade, "ph"), ph);
+
+	/* Band row 1 is step first, row 0 the one before */
+	if (gpu_row_put(0, reversible ? init_prev : zeroes) || gpu_row_put(1, init))
+		return 1;
+
+	while (y < p->h) {
+		n = GP_MIN(band, height - first - 1);
+		gpu_steps(1, n);
+		CA1D_STAT_ADD(words, n * width);
+		CA1D_STAT_ADD(rows, n);
+
+		for (y1 = y; y1 < p->h && (size_t)((float)y1 * ph) <= first + n; y1++)
+			;
+
+		for (; y < y1; y += GP_MIN(batch, y1 - y)) {
+			if (gpu_shade(p, y, y + GP_MIN(batch, y1 - y), (GLint)first - 1))
+				return 1;
+		}
+
+		if (!n)
+			break;
+
+		/* One row at a time as they overlap when n is 1 */
+		glBindBuffer(GL_COPY_READ_BUFFER, gpu_state.bufs[0]);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, gpu_state.bufs[0]);
+		for (i = 0; i < 2; i++) {
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+					    (n + i) * width * 8, i * width * 8, width * 8);
+		}
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+		first += n;
+	}
+
+	if (glGetError() != GL_NO_ERROR) {
+		errno = EIO;
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Evolve the automaton on the GPU and save it as an image */
+static int gpu_save(const char *path, const float scale)
+{
+	gp_pixmap *pxm = gp_pixmap_alloc(ca1d_cells() * scale, height * scale, GP_PIXEL_G1);
+	int ret = 1;
+
+	if (!pxm)
+		return 1;
+
+	if (gpu_render(pxm, 1.0f / scale, 1.0f / scale,
+		       gp_rgb_to_pixmap_pixel(0xff, 0xff, 0xff, pxm),
+		       gp_rgb_to_pixmap_pixel(0x00, 0x00, 0x00, pxm))) {
+		if (errno == ENOTSUP)
+			fprintf(stderr, "The GPU only evolves elementary and meta rules\n");
+		else if (errno != ENODEV)
+			fprintf(stderr, "Rendering on the GPU failed\n");
+	} else if (gp_save_image(pxm, path, NULL)) {
+		perror("Save Failed!");
+	} else {
+		ret = 0;
+	}
+
+	gp_pixmap_free(pxm);
+
+	return ret;
+}
+#endif
+
+/* A rule evaluated by the sweep and the summary of its run */
+struct sweep_case {
+	uint8_t rule;
+	/* Non-zero for a meta rule choosing between the first two rules */
+	uint8_t meta_rule;
+	int reversible;
+	uint64_t pop_sum;
+	uint64_t pop_last;
+	/* Steps before the first state which repeats and how often it does,
+	 * the period is zero if no state repeats within the steps.
+	 */
+	size_t transient;
+	size_t period;
+};
+
+/* Evaluates many rules from the same initial conditions
+ *
+ * The rules are shared out between the threads, each of which keeps one
+ * matrix of steps per case in the batch it evolves at once.
+ */
+struct sweep {
+	struct sweep_case *cases;
+	size_t n;
+	/* Next case to be taken by a thread */
+	size_t next;
+	/* Contact sheet with a tile per case, may be NULL */
+	gp_pixmap *sheet;
+	/* Directory to save an image per case to, may be NULL */
+	const char *dir;
+	/* Pixels per cell and the size of a tile */
+	unsigned int k;
+	uint32_t tile_w, tile_h, cols;
+	/* Evolve the rules 64 at a time bit-sliced */
+	int sliced;
+	/* Cases a thread takes at once, up to 64 when sliced */
+	size_t batch;
+	int failed;
+};
+
+/* Space between the contact sheet tiles, a whole byte of G1 pixels */
+#define SWEEP_GAP 8
+
+/* Add the rules in a list such as "0-255,30r" to the sweep
+ *
+ * A trailing r makes the rules reversible, as does -e for all of them.
+ * Meta rules start from 1 as meta rule 0 disables it.
+ */
+static int sweep_parse(struct sweep *self, const char *str, const int meta)
+{
+	const char *c = str;
+
+	while (*c) {
+		unsigned long lo, hi;
+		int rev = reversible;
+		char *end;
+
+		lo = hi = strtoul(c, &end, 10);
+		if (end == c)
+			return 1;
+		c = end;
+
+		if (*c == '-') {
+			hi = strtoul(++c, &end, 10);
+			if (end == c)
+				return 1;
+			c = end;
+		}
+
+		if (*c == 'r') {
+			rev = 1;
+			c++;
+		}
+
+		if (*c == ',')
+			c++;
+		else if (*c)
+			return 1;
+
+		if (lo > hi || hi > 255 || (meta && !lo))
+			return 1;
+
+		for (; lo <= hi; lo++) {
+			struct sweep_case *cases =
+				realloc(self->cases, (self->n + 1) * sizeof(*cases));
+
+			if (!cases)
+				return 1;
+
+			self->cases = cases;
+			cases[self->n++] = (struct sweep_case) {
+				.rule = meta ? 0 : lo,
+				.meta_rule = meta ? lo : 0,
+				.reversible = rev,
+			};
+		}
+	}
+
+	return 0;
+}
+
+/* Look for step i's state among the earlier ones, returns non-zero once a
+ * state repeats
+ */
+static int sweep_cycle(struct ca1d_cycle *cycle, struct sweep_case *c,
+		       const uint64_t *rows, const size_t i)
+{
+	const size_t bytes = width * sizeof(uint64_t);
+	const uint64_t *row = rows + gp_matrix_idx(width, i, 0);
+	const size_t j = ca1d_cycle_step(cycle, row, i, c->reversible);
+	const uint64_t *before;
+
+	if (j == SIZE_MAX)
+		return 0;
+
+	if (memcmp(rows + gp_matrix_idx(width, j, 0), row, bytes))
+		return 0;
+
+	before = j ? rows + gp_matrix_idx(width, j - 1, 0) : zeroes;
+	if (c->reversible && memcmp(before, row - width, bytes))
+		return 0;
+
+	c->transient = j;
+	c->period = i - j;
+
+	return 1;
+}
+
+/* Evolve a case, once a state repeats the remaining steps are copied
+ * from the cycle rather than evolved
+ */
+static void sweep_evolve(struct sweep_case *c, struct ca1d_cycle *cycle,
+			 uint64_t *rows)
+{
+	size_t i;
+
+	memcpy(rows, init, width * sizeof(uint64_t));
+	ca1d_cycle_reset(cycle);
+	sweep_cycle(cycle, c, rows, 0);
+
+	for (i = 1; i < height; i++) {
+		const uint64_t *prev = c->reversible && i > 1 ?
+			rows + gp_matrix_idx(width, i - 2, 0) : zeroes;
+		const uint64_t *cur = rows + gp_matrix_idx(width, i - 1, 0);
+		uint64_t *next = rows + gp_matrix_idx(width, i, 0);
+
+		if (c->meta_rule) {
+			ca1d_meta_rules_apply_row(c->meta_rule, rules[0], rules[1],
+						  prev, cur, next, 0, width);
+		} else {
+			ca1d_row_fns[c->rule](prev, cur, next, 0, width);
+		}
+
+		if (sweep_cycle(cycle, c, rows, i))
+			break;
+	}
+
+	for (i++; i < height; i++) {
+		memcpy(rows + gp_matrix_idx(width, i, 0),
+		       rows + gp_matrix_idx(width, i - c->period, 0),
+		       width * sizeof(uint64_t));
+	}
+}
+
+/* Find the cycle of a case which was evolved bit-sliced */
+static void sweep_detect(struct sweep_case *c, struct ca1d_cycle *cycle,
+			 const uint64_t *rows)
+{
+	size_t i;
+
+	ca1d_cycle_reset(cycle);
+
+	for (i = 0; i < height; i++) {
+		if (sweep_cycle(cycle, c, rows, i))
+			return;
+	}
+}
+
+static void sweep_summarise(struct sweep_case *c, const uint64_t *rows)
+{
+	size_t i;
+
+	c->pop_sum = 0;
+	c->pop_last = 0;
+
+	for (i = 0; i < width * height; i++)
+		c->pop_sum += pop_count(rows[i]);
+
+	for (i = 0; i < width; i++)
+		c->pop_last += pop_count(rows[gp_matrix_idx(width, height - 1, i)]);
+}
+
+/* Shade the rows into p at (x, y) with k pixels per cell, x must be a
+ * multiple of 8 so each tile is made of whole bytes.
+ */
+static void sweep_render(gp_pixmap *p, const uint32_t x, const uint32_t y,
+			 const uint64_t *rows, const unsigned int k)
+{
+	const gp_pixel bg = gp_rgb_to_pixmap_pixel(0xff, 0xff, 0xff, p);
+	const gp_pixel fg = gp_rgb_to_pixmap_pixel(0x00, 0x00, 0x00, p);
+	const size_t len = (ca1d_cells() * k + 7) / 8;
+	size_t j;
+	unsigned int r;
+
+	for (j = 0; j < height; j++) {
+		uint8_t *line = p->pixels + (size_t)(y + j * k) * p->bytes_per_row + x / 8;
+
+		row_to_g1(rows + gp_matrix_idx(width, j, 0), line, len, k, bg, fg);
+
+		for (r = 1; r < k; r++)
+			memcpy(line + r * p->bytes_per_row, line, len);
+	}
+}
+
+static int sweep_save(const struct sweep *self, const struct sweep_case *c,
+		      const uint64_t *rows)
+{
+	char path[strlen(self->dir) + 32];
+	gp_pixmap *p = gp_pixmap_alloc(self->tile_w, self->tile_h, GP_PIXEL_G1);
+	int ret;
+
+	if (!p)
+		return 1;
+
+	snprintf(path, sizeof(path), "%s/%s%03u%s.png", self->dir,
+		 c->meta_rule ? "meta" : "rule",
+		 c->meta_rule ? c->meta_rule : c->rule,
+		 c->reversible ? "r" : "");
+
+	sweep_render(p, 0, 0, rows, self->k);
+	ret = gp_save_image(p, path, NULL);
+	if (ret)
+		fprintf(stderr, "Saving %s failed: %s\n", path, strerror(errno));
+
+	gp_pixmap_free(p);
+
+	return ret;
+}
+
+/* Evolve the rules, but not the meta rules, of the cases [n, end)
+ * together bit-sliced, writing each one's steps to runs[case - n]
+ */
+static int sweep_evolve_sliced(const struct sweep *self, const size_t n,
+			       const size_t end, uint64_t *const *runs)
+{
+	const size_t cells = 64 * width;
+	struct ca1d_sliced_rules rs = { .reversible = 0 };
+	const uint64_t *in[64] = { NULL };
+	uint64_t *out[64] = { NULL };
+	uint64_t *ring = gp_vec_new(3 * cells, sizeof(uint64_t));
+	size_t i, b;
+
+	if (!ring)
+		return 1;
+
+	for (b = 0; b < end - n; b++) {
+		const struct sweep_case *c = self->cases + n + b;
+
+		if (c->meta_rule)
+			continue;
+
+		ca1d_sliced_rules_set(&rs, b, c->rule, c->reversible);
+		in[b] = init;
+		memcpy(runs[b], init, width * sizeof(uint64_t));
+	}
+
+	/* The third row is the zeroes before the first step */
+	ca1d_slice(in, ring);
+
+	for (i = 1; i < height; i++) {
+		uint64_t *next = ring + (i % 3) * cells;
+
+		ca1d_sliced_row(&rs, ring + ((i + 1) % 3) * cells,
+				ring + ((i - 1) % 3) * cells, next, ca1d_cells());
+
+		for (b = 0; b < end - n; b++)
+			out[b] = in[b] ? runs[b] + gp_matrix_idx(width, i, 0) : NULL;
+
+		ca1d_unslice(next, out);
+	}
+
+	gp_vec_free(ring);
+
+	return 0;
+}
+
+static void *sweep_main(void *arg)
+{
+	struct sweep *self = arg;
+	const size_t batch = self->batch;
+	struct ca1d_cycle cycle;
+	uint64_t *runs[batch];
+	size_t n, i, b;
+
+	memset(runs, 0, sizeof(runs));
+
+	if (ca1d_cycle_init(&cycle)) {
+		__atomic_store_n(&self->failed, 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+
+	for (b = 0; b < batch; b++) {
+		runs[b] = gp_matrix_new(width, height, sizeof(uint64_t));
+
+		if (!runs[b]) {
+			__atomic_store_n(&self->failed, 1, __ATOMIC_RELAXED);
+			goto out;
+		}
+	}
+
+	while ((n = __atomic_fetch_add(&self->next, batch, __ATOMIC_RELAXED)) < self->n) {
+		const size_t end = GP_MIN(n + batch, self->n);
+
+		if (self->sliced && sweep_evolve_sliced(self, n, end, runs)) {
+			__atomic_store_n(&self->failed, 1, __ATOMIC_RELAXED);
+			break;
+		}
+
+		for (i = n; i < end; i++) {
+			struct sweep_case *c = self->cases + i;
+			const uint64_t *rows = runs[i - n];
+			const uint32_t x = SWEEP_GAP + (i % self->cols) * (self->tile_w + SWEEP_GAP);
+			const uint32_t y = SWEEP_GAP + (i / self->cols) * (self->tile_h + SWEEP_GAP);
+
+			c->transient = c->period = 0;
+
+			if (!self->sliced || c->meta_rule)
+				sweep_evolve(c, &cycle, runs[i - n]);
+			else
+				sweep_detect(c, &cycle, rows);
+
+			sweep_summarise(c, rows);
+
+			if (self->sheet)
+				sweep_render(self->sheet, x, y, rows, self->k);
+
+			if (self->dir && sweep_save(self, c, rows))
+				__atomic_store_n(&self->failed, 1, __ATOMIC_RELAXED);
+		}
+	}
+
+out:
+	for (b = 0; b < batch && runs[b]; b++)
+		gp_vec_free(runs[b]);
+
+	ca1d_cycle_free(&cycle);
+
+	return NULL;
+}
+
+static void sweep_print(const struct sweep *self)
+{
+	const double cells = ca1d_cells();
+	size_t n;
+
+	printf("%-8s %10s %10s %9s %8s\n",
+	       "Rule", "Density", "Last", "Transient", "Period");
+
+	for (n = 0; n < self->n; n++) {
+		const struct sweep_case *c = self->cases + n;
+		char name[8];
+
+		snprintf(name, sizeof(name), "%s%u%s", c->meta_rule ? "m" : "",
+			 c->meta_rule ? c->meta_rule : c->rule,
+			 c->reversible ? "r" : "");
+
+		printf("%-8s %10f %10f %9zu %8zu\n", name,
+		       c->pop_sum / (cells * height), c->pop_last / cells,
+		       c->transient, c->period);
+	}
+}
+
+/* Evaluate the swept rules, saving a contact sheet to sheet_path and or
+ * an image per rule to dir, then print a summary of each rule.
+ */
+static int sweep_run(struct sweep *self, const char *sheet_path, const float scale)
+{
+	const size_t batch = self->sliced ? GP_MIN((size_t)64, self->n) : 1;
+	const size_t batches = (self->n + batch - 1) / batch;
+	const unsigned int n = GP_MAX(1UL, GP_MIN(threads, batches));
+	const long pages = sysconf(_SC_PHYS_PAGES);
+	pthread_t workers[n];
+	unsigned int t, m, rows;
+	int ret = 0;
+
+	/* Every thread keeps a matrix of steps per case in its batch, so
+	 * refuse to start rather than be killed once they are touched.
+	 */
+	self->batch = batch;
+	if (height > SIZE_MAX / sizeof(uint64_t) / width / batch / n ||
+	    (pages > 0 && width * height * sizeof(uint64_t) * batch * n / pages >=
+	     (size_t)sysconf(_SC_PAGESIZE))) {
+		fprintf(stderr, "The sweep needs %zu matrices of %zux%zu segments, more than the memory, try fewer threads or steps\n",
+			batch * n, width, height);
+		free(self->cases);
+		return 1;
+	}
+
+	self->k = scale >= 1 ? scale : 1;
+	/* Whole bytes so each tile starts on a byte */
+	self->tile_w = (ca1d_cells() * self->k + 7) & ~7UL;
+	self->tile_h = height * self->k;
+
+	for (self->cols = 1; self->cols * self->cols < self->n; self->cols++)
+		;
+	rows = (self->n + self->cols - 1) / self->cols;
+
+	if (sheet_path) {
+		self->sheet = gp_pixmap_alloc(SWEEP_GAP + self->cols * (self->tile_w + SWEEP_GAP),
+					      SWEEP_GAP + rows * (self->tile_h + SWEEP_GAP),
+					      GP_PIXEL_G1);
+		if (!self->sheet) {
+			fprintf(stderr, "Allocating the contact sheet failed\n");
+			return 1;
+		}
+
+		gp_fill(self->sheet, gp_rgb_to_pixmap_pixel(0xff, 0xff, 0xff, self->sheet));
+	}
+
+	/* Fill the lazily built tables before the threads share them */
+	g1_msb_first();
+	if (row_bits_prepare(self->k)) {
+		perror("Allocating the pixel table failed");
+		gp_pixmap_free(self->sheet);
+		free(self->cases);
+		return 1;
+	}
+
+	for (m = 1; m < n; m++) {
+		if (pthread_create(&workers[m], NULL, sweep_main, self)) {
+			perror("pthread_create");
+			break;
+		}
+	}
+
+	sweep_main(self);
+
+	for (t = 1; t < m; t++)
+		pthread_join(workers[t], NULL);
+
+	if (self->failed) {
+		fprintf(stderr, "Sweep failed\n");
+		ret = 1;
+	}
+
+	if (self->sheet && gp_save_image(self->sheet, sheet_path, NULL)) {
+		perror("Save Failed!");
+		ret = 1;
+	}
+
+	if (!ret)
+		sweep_print(self);
+
+	gp_pixmap_free(self->sheet);
+	free(self->cases);
+
+	return ret;
+}
+
+/* One step of an ensemble, summed over its runs */
+struct ensemble_step {
+	uint64_t pop;
+	double pop_sq;
+	/* How often each pattern of 4 cells occurs, in whole blocks */
+	uint64_t blocks[16];
+	/* Cells which differ from the run with the middle cell flipped */
+	uint64_t damage;
+};
+
+/* Evolves the rules from many random initial conditions
+ *
+ * The runs are shared out between the threads. Each one evolves a run
+ * and a copy with the middle cell flipped in a ring of rows, adding
+ * their statistics to its own sums of each step, so no steps are kept.
+ */
+struct ensemble {
+	size_t runs;
+	/* Chance of each initial cell being live */
+	float density;
+	uint64_t seed;
+	/* Next run to be taken by a thread */
+	size_t next;
+};
+
+struct ensemble_worker {
+	pthread_t thread;
+	struct ensemble *ens;
+	struct ensemble_step *sums;
+	int failed;
+};
+
+/* xoshiro256** seeded with splitmix64 */
+struct ensemble_rng {
+	uint64_t s[4];
+};
+
+static uint64_t ensemble_splitmix(uint64_t *x)
+{
+	uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+	return z ^ (z >> 31);
+}
+
+static inline uint64_t ensemble_rotl(const uint64_t x, const int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t ensemble_rng_next(struct ensemble_rng *self)
+{
+	uint64_t *s = self->s;
+	const uint64_t r = ensemble_rotl(s[1] * 5, 7) * 9;
+	const uint64_t t = s[1] << 17;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = ensemble_rotl(s[3], 45);
+
+	return r;
+}
+
+/* Each run has its own stream, so the results do not depend on which
+ * thread evolves it
+ */
+static void ensemble_rng_seed(struct ensemble_rng *self, const uint64_t seed,
+			      const size_t run)
+{
+	uint64_t x = seed ^ ensemble_splitmix(&(uint64_t){ run });
+	unsigned int i;
+
+	for (i = 0; i < 4; i++)
+		self->s[i] = ensemble_splitmix(&x);
+}
+
+/* Fill row with cells which are live with the chance p / 65536
+ *
+ * Each bit of p, from the lowest set one up, ANDs or ORs in another
+ * random word, which halves the chance and adds the bit to it. So 64
+ * cells take at most 16 random words, or one at a density of 0.5.
+ */
+static void ensemble_row_fill(struct ensemble_rng *rng, uint64_t *row,
+			      const uint32_t p)
+{
+	const unsigned int lo = p ? __builtin_ctz(p) : 16;
+	size_t i;
+	unsigned int k;
+
+	for (i = 0; i < width; i++) {
+		uint64_t x = p >> 16 ? ~0ULL : 0;
+
+		for (k = lo; k < 16; k++) {
+			const uint64_t r = ensemble_rng_next(rng);
+
+			x = (p >> k) & 1 ? x | r : x & r;
+		}
+
+		row[i] = x;
+	}
+
+	row[width - 1] &= ca1d_tail_mask();
+}
+
+/* Count the patterns of the row's whole blocks of 4 cells */
+static void ensemble_blocks(const uint64_t *row, uint64_t *blocks)
+{
+	const size_t n = ca1d_cells() / 4;
+	uint32_t counts[16] = { 0 };
+	size_t j;
+	unsigned int k;
+
+	for (j = 0; j < n / 16; j++) {
+		const uint64_t w = row[j];
+
+		for (k = 0; k < 64; k += 4)
+			counts[(w >> k) & 15]++;
+	}
+
+	for (k = 0; k < n % 16; k++)
+		counts[(row[j] >> (60 - 4 * k)) & 15]++;
+
+	for (k = 0; k < 16; k++)
+		blocks[k] += counts[k];
+}
+
+/* The Shannon entropy of the blocks of 4 cells in bits per cell */
+static double ensemble_entropy(const uint64_t *blocks)
+{
+	double n = 0, sum = 0;
+	unsigned int b;
+
+	for (b = 0; b < 16; b++) {
+		n += blocks[b];
+		if (blocks[b])
+			sum += blocks[b] * log2(blocks[b]);
+	}
+
+	return n ? (log2(n) - sum / n) / 4 : 0;
+}
+
+static void ensemble_evolve(struct ensemble_worker *self, const size_t run,
+			    uint64_t *ring)
+{
+	const struct ensemble *ens = self->ens;
+	const size_t mid = ca1d_cells() / 2;
+	uint64_t *flipped = ring + 3 * width;
+	struct ensemble_rng rng;
+	size_t i, j;
+
+	ensemble_rng_seed(&rng, ens->seed, run);
+	ensemble_row_fill(&rng, ring, GP_MIN(65536U, (uint32_t)(ens->density * 65536 + 0.5f)));
+	memcpy(flipped, ring, width * sizeof(uint64_t));
+	flipped[mid / 64] ^= 1ULL << (63 - mid % 64);
+
+	for (i = 0; i < height; i++) {
+		const uint64_t *cur = ring + (i % 3) * width;
+		const uint64_t *fcur = flipped + (i % 3) * width;
+		struct ensemble_step *s = self->sums + i;
+		uint64_t pop = 0, damage = 0;
+
+		for (j = 0; j < width; j++) {
+			pop += pop_count(cur[j]);
+			damage += pop_count(cur[j] ^ fcur[j]);
+		}
+
+		s->pop += pop;
+		s->pop_sq += (double)pop * pop;
+		ensemble_blocks(cur, s->blocks);
+		s->damage += damage;
+
+		if (i + 1 == height)
+			break;
+
+		ca1d_step_row(reversible && i ? ring + ((i + 2) % 3) * width : zeroes,
+			      cur, ring + ((i + 1) % 3) * width, 0, width);
+		ca1d_step_row(reversible && i ? flipped + ((i + 2) % 3) * width : zeroes,
+			      fcur, flipped + ((i + 1) % 3) * width, 0, width);
+		CA1D_STAT_ADD(words, 2 * width);
+	}
+}
+
+static void *ensemble_main(void *arg)
+{
+	struct ensemble_worker *self = arg;
+	uint64_t *ring = gp_vec_new(6 * width, sizeof(uint64_t));
+	size_t run;
+
+	self->sums = calloc(height, sizeof(*self->sums));
+
+	if (!ring || !self->sums) {
+		self->failed = 1;
+		goto out;
+	}
+
+	while ((run = __atomic_fetch_add(&self->ens->next, 1, __ATOMIC_RELAXED)) < self->ens->runs)
+		ensemble_evolve(self, run, ring);
+
+out:
+	if (ring)
+		gp_vec_free(ring);
+
+	return NULL;
+}
+
+static void ensemble_print(const struct ensemble *self, const struct ensemble_step *sums)
+{
+	const double cells = ca1d_cells();
+	const double runs = self->runs;
+	size_t i;
+
+	printf("%-10s %10s %10s %10s %10s\n",
+	       "Step", "Density", "Deviation", "Entropy", "Damage");
+
+	for (i = 0; i < height; i++) {
+		const struct ensemble_step *s = sums + i;
+		const double mean = s->pop / runs;
+
+		printf("%-10zu %10f %10f %10f %10f\n", i,
+		       mean / cells, sqrt(GP_MAX(0.0, s->pop_sq / runs - mean * mean)) / cells,
+		       ensemble_entropy(s->blocks), s->damage / (cells * runs));
+	}
+}
+
+/* Evolve the ensemble's runs and print the statistics of each step */
+static int ensemble_run(struct ensemble *self)
+{
+	const unsigned int n = GP_MAX(1UL, GP_MIN(threads, self->runs));
+	struct ensemble_worker workers[n];
+	unsigned int t, m, b;
+	size_t i;
+	int ret = 0;
+
+	memset(workers, 0, sizeof(workers));
+
+	for (m = 0; m < n; m++) {
+		workers[m].ens = self;
+
+		if (m && pthread_create(&workers[m].thread, NULL, ensemble_main, &workers[m])) {
+			perror("pthread_create");
+			break;
+		}
+	}
+
+	ensemble_main(&workers[0]);
+
+	for (t = 1; t < m; t++)
+		pthread_join(workers[t].thread, NULL);
+
+	for (t = 0; t < m; t++)
+		ret |= workers[t].failed;
+
+	if (ret) {
+		fprintf(stderr, "Allocating the ensemble failed\n");
+		goto out;
+	}
+
+	for (t = 1; t < m; t++) {
+		for (i = 0; i < height; i++) {
+			workers[0].sums[i].pop += workers[t].sums[i].pop;
+			workers[0].sums[i].pop_sq += workers[t].sums[i].pop_sq;
+			workers[0].sums[i].damage += workers[t].sums[i].damage;
+
+			for (b = 0; b < 16; b++)
+				workers[0].sums[i].blocks[b] += workers[t].sums[i].blocks[b];
+		}
+	}
+
+	ensemble_print(self, workers[0].sums);
+out:
+	for (t = 0; t < m; t++)
+		free(workers[t].sums);
+
+	return ret;
+}
+
+/* The benchmark's cases, covering each path of the engine and renderer */
+static const struct bench_case {
+	size_t width, height;
+	const char *rules;
+	int reversible;
+	uint8_t meta_rule;
+	float scale;
+	/* Generations of a 2D automaton with rules as its B/S rule, if set */
+	unsigned int generations;
+} bench_cases[] = {
+	{ 16, 32768, "30", 0, 0, 1, 0 },
+	{ 16, 32768, "30", 1, 0, 1, 0 },
+	{ 16, 32768, "30,90", 0, 0, 1, 0 },
+	{ 16, 32768, "30,90", 0, 150, 1, 0 },
+	{ 16, 32768, "30", 0, 150, 1, 0 },
+	{ 64, 4096, "90", 0, 0, 2, 0 },
+	{ 1024, 1024, "90", 0, 0, 1, 0 },
+	{ 4096, 2048, "110", 0, 0, 0.25, 0 },
+	{ 4096, 2048, "45", 1, 0, 0.25, 0 },
+	{ 1024, 1024, "r2:0x96696996", 0, 0, 1, 0 },
+	{ 1024, 1024, "t3:0x58", 0, 0, 1, 0 },
+	{ 64, 4096, "B3/S23", 0, 0, 0.25, 16 },
+	{ 1024, 1024, "B36/S23", 0, 0, 0.125, 4 },
+};
+
+/* Runs of each stage before the timed ones and the number timed */
+#define BENCH_WARMUP 1
+#define BENCH_REPS 5
+
+/* A case is a regression if its median is this much slower */
+#define BENCH_TOLERANCE 1.2
+
+struct bench_result {
+	char name[64];
+	uint64_t sim_ns, sim_min_ns;
+	uint64_t render_ns, render_min_ns;
+	/* Simulating and rendering on the GPU, zero if it was not run */
+	uint64_t gpu_ns, gpu_min_ns;
+	/* Whether the GPU's image is the same as the CPU's */
+	int gpu_identical;
+};
+
+static uint64_t bench_now_ns(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+
+	return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static int bench_cmp(const void *a, const void *b)
+{
+	const uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static const char *ca1d_isa_name(void)
+{
+	size_t i;
+
+	for (i = 0; i < GP_ARRAY_SIZE(ca1d_isas); i++) {
+		if (ca1d_isas[i].row_fns == ca1d_row_fns)
+			return ca1d_isas[i].name;
+	}
+
+	return "unknown";
+}
+
+/* Time a stage, returning the median and fastest of the repetitions */
+static void bench_stage(void (*stage)(void *), void *arg,
+			uint64_t *median, uint64_t *min)
+{
+	uint64_t ns[BENCH_REPS];
+	unsigned int r;
+
+	for (r = 0; r < BENCH_WARMUP; r++)
+		stage(arg);
+
+	for (r = 0; r < BENCH_REPS; r++) {
+		const uint64_t s = bench_now_ns();
+
+		stage(arg);
+		ns[r] = bench_now_ns() - s;
+	}
+
+	qsort(ns, BENCH_REPS, sizeof(*ns), bench_cmp);
+	*median = ns[BENCH_REPS / 2];
+	*min = ns[0];
+}
+
+/* The random grid a 2D case starts from each time */
+static uint64_t *bench_grid;
+
+static void bench_simulate(void *arg)
+{
+	const struct bench_case *c = arg;
+
+	if (!c->generations) {
+		ca1d_run(NULL);
+		return;
+	}
+
+	memcpy(steps, bench_grid, width * height * sizeof(uint64_t));
+	ca2d_evolve(c->generations, NULL);
+}
+
+static void bench_render(void *arg)
+{
+	gp_pixmap *p = arg;
+	gp_pixel bg = gp_rgb_to_pixmap_pixel(0xff, 0xff, 0xff, p);
+	gp_pixel fg = gp_rgb_to_pixmap_pixel(0x00, 0x00, 0x00, p);
+
+	/* The densities are part of rendering, not something cached */
+	pops_rows = 0;
+	render_pixmap(p, (float)64 * width / p->w, (float)height / p->h,
+		      bg, fg, 1, 0, p->h);
+}
+
+#ifdef HAVE_GLES
+static int bench_gpu_failed;
+
+static void bench_gpu(void *arg)
+{
+	gp_pixmap *p = arg;
+	gp_pixel bg = gp_rgb_to_pixmap_pixel(0xff, 0xff, 0xff, p);
+	gp_pixel fg = gp_rgb_to_pixmap_pixel(0x00, 0x00, 0x00, p);
+
+	bench_gpu_failed |= gpu_render(p, (float)64 * width / p->w,
+				       (float)height / p->h, bg, fg);
+}
+
+/* Compare the pixels of two G1 pixmaps of the same size */
+static int bench_identical(const gp_pixmap *p, const gp_pixmap *q)
+{
+	uint32_t x, y;
+
+	for (y = 0; y < p->h; y++) {
+		if (memcmp(p->pixels + (size_t)y * p->bytes_per_row,
+			   q->pixels + (size_t)y * q->bytes_per_row, p->w / 8))
+			return 0;
+
+		for (x = p->w & ~7U; x < p->w; x++) {
+			if (gp_getpixel_raw(p, x, y) != gp_getpixel_raw(q, x, y))
+				return 0;
+		}
+	}
+
+	return 1;
+}
+
+/* Time the case on the GPU and check it against the CPU's image p */
+static int bench_case_gpu(const gp_pixmap *p, struct bench_result *res)
+{
+	gp_pixmap *q = gp_pixmap_alloc(p->w, p->h, GP_PIXEL_G1);
+
+	if (!q)
+		return 1;
+
+	bench_gpu_failed = 0;
+	bench_stage(bench_gpu, q, &res->gpu_ns, &res->gpu_min_ns);
+	res->gpu_identical = !bench_gpu_failed && bench_identical(p, q);
+	gp_pixmap_free(q);
+
+	return bench_gpu_failed;
+}
+#endif
+
+static int bench_case_run(const struct bench_case *c, struct bench_result *res)
+{
+	uint64_t x = 0x9e3779b97f4a7c15ULL;
+	gp_pixmap *p;
+	size_t i;
+
+	width = c->width;
+	tail = 64;
+	height = c->height;
+	ca2d = !!c->generations;
+	/* A meta rule with one rule reads the second as zero */
+	memset(rules, 0, sizeof(rules));
+	if (ca2d ? ca2d_rule_parse(c->rules, &ca2d_bs) : parse_rule_nums(c->rules)) {
+		fprintf(stderr, "Invalid benchmark rules '%s'\n", c->rules);
+		return 1;
+	}
+	reversible = c->reversible;
+	meta_rule = c->meta_rule;
+	streaming = 0;
+	if (ca1d_allocate()) {
+		perror("Allocating rows failed");
+		return 1;
+	}
+
+	if (bench_grid)
+		gp_vec_free(bench_grid);
+	bench_grid = ca2d ? gp_matrix_new(width, height, sizeof(uint64_t)) : NULL;
+
+	/* Every cell is live or dead at random so that the whole row is
+	 * evolved, the same cells each time
+	 */
+	for (i = 0; i < (ca2d ? width * height : width); i++) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		(ca2d ? bench_grid : init)[i] = x;
+	}
+
+	snprintf(res->name, sizeof(res->name), "w%zu-h%zu-r%s%s-m%u-s%g",
+		 c->width, c->height, c->rules, c->reversible ? "e" : "",
+		 c->meta_rule, c->scale);
+	if (ca2d)
+		snprintf(res->name + strlen(res->name), sizeof(res->name) - strlen(res->name),
+			 "-g%u", c->generations);
+
+	p = gp_pixmap_alloc(64 * width * c->scale, height * c->scale, GP_PIXEL_G1);
+	if (!p)
+		return 1;
+
+	bench_stage(bench_simulate, (void *)c, &res->sim_ns, &res->sim_min_ns);
+	bench_stage(bench_render, p, &res->render_ns, &res->render_min_ns);
+
+	res->gpu_ns = res->gpu_min_ns = 0;
+#ifdef HAVE_GLES
+	if (gpu && !ca2d && wide_rule.kind == CA1D_RULE_ELEMENTARY &&
+	    bench_case_gpu(p, res)) {
+		gp_pixmap_free(p);
+		return 1;
+	}
+#endif
+
+	gp_pixmap_free(p);
+
+	return 0;
+}
+
+/* Compare with the results of an earlier run, printed by bench_print
+ *
+ * Returns non-zero if a case got slower by more than BENCH_TOLERANCE.
+ */
+static int bench_compare(const char *path, const struct bench_result *res,
+			 const size_t n)
+{
+	FILE *f = fopen(path, "r");
+	char line[512], name[64];
+	uint64_t sim, render;
+	int ret = 0;
+	size_t i;
+	char *c;
+
+	if (!f) {
+		perror("Opening baseline failed");
+		return 1;
+	}
+
+	fprintf(stderr, "%-32s %10s %10s\n", "Case", "Simulate", "Render");
+
+	while (fgets(line, sizeof(line), f)) {
+		if (!(c = strstr(line, "\"name\": \"")) ||
+		    sscanf(c, "\"name\": \"%63[^\"]\"", name) != 1)
+			continue;
+
+		if (!(c = strstr(line, "\"sim_ns\": ")) ||
+		    sscanf(c, "\"sim_ns\": %" SCNu64, &sim) != 1 ||
+		    !(c = strstr(line, "\"render_ns\": ")) ||
+		    sscanf(c, "\"render_ns\": %" SCNu64, &render) != 1)
+			continue;
+
+		for (i = 0; i < n && strcmp(res[i].name, name); i++)
+			;
+
+		if (i == n || !sim || !render)
+			continue;
+
+		const double ds = (double)res[i].sim_ns / sim;
+		const double dr = (double)res[i].render_ns / render;
+		const int slower = ds > BENCH_TOLERANCE || dr > BENCH_TOLERANCE;
 
-			rule_acc *= 10;
-			rule_acc += ((*c) - '0');
-			break;
-		case ',':
-		case ';':
-			rules[rule_indx] = rule_acc;
-			rule_indx++;
-			rule_acc = 0;
-			break;
-		case ' ':
-			break;
-		default:
-			return;
+		fprintf(stderr, "%-32s %9.2fx %9.2fx%s\n", name, ds, dr,
+			slower ? " slower" : "");
+		ret |= slower;
+	}
+
+	fclose(f);
+
+	return ret;
+}
+
+static void bench_print(const struct bench_result *res, const size_t n)
+{
+	size_t i;
+
+	printf("{\n\t\"kernel\": \"%s\",\n\t\"threads\": %u,\n\t\"tile_steps\": %zu,\n",
+	       ca1d_isa_name(), threads, tile_steps);
+	printf("\t\"warmup\": %u,\n\t\"repetitions\": %u,\n\t\"cases\": [\n",
+	       BENCH_WARMUP, BENCH_REPS);
+
+	for (i = 0; i < n; i++) {
+		const struct bench_case *c = &bench_cases[i];
+		const double cells = 64.0 * c->width * c->height * GP_MAX(1U, c->generations);
+		const double pixels = 64.0 * c->width * c->scale * (uint32_t)(c->height * c->scale);
+
+		printf("\t\t{\"name\": \"%s\", \"width\": %zu, \"height\": %zu, "
+		       "\"rules\": \"%s\", \"reversible\": %d, \"meta_rule\": %u, "
+		       "\"scale\": %g, \"generations\": %u, \"sim_ns\": %" PRIu64 ", "
+		       "\"sim_min_ns\": %" PRIu64 ", \"cells_per_s\": %.4g, "
+		       "\"render_ns\": %" PRIu64 ", \"render_min_ns\": %" PRIu64 ", "
+		       "\"pixels_per_s\": %.4g",
+		       res[i].name, c->width, c->height, c->rules, c->reversible,
+		       c->meta_rule, c->scale, c->generations, res[i].sim_ns, res[i].sim_min_ns,
+		       cells * 1e9 / res[i].sim_ns, res[i].render_ns,
+		       res[i].render_min_ns, pixels * 1e9 / res[i].render_ns);
+
+		if (res[i].gpu_ns) {
+			printf(", \"gpu_ns\": %" PRIu64 ", \"gpu_min_ns\": %" PRIu64 ", "
+			       "\"gpu_identical\": %d",
+			       res[i].gpu_ns, res[i].gpu_min_ns, res[i].gpu_identical);
 		}
 
-		c++;
+		printf("}%s\n", i + 1 < n ? "," : "");
 	}
 
-out:
-	rules[rule_indx] = rule_acc;
-	rule_n = rule_indx + 1;
+	printf("\t]\n}\n");
 }
 
-int rule_widget_on_event(gp_widget_event *ev)
+/* Print how much faster the GPU simulated and rendered each case than
+ * the CPU, returns non-zero if any of its images differ
+ */
+static int bench_gpu_compare(const struct bench_result *res, const size_t n)
 {
-	if (ev->type != GP_WIDGET_EVENT_WIDGET)
-		return 0;
+	int ret = 0;
+	size_t i;
 
-	switch(ev->self->type) {
-	case GP_WIDGET_TBOX:
-		switch(ev->sub_type) {
-		case GP_WIDGET_TBOX_PRE_FILTER:
-			switch ((char)ev->val) {
-			case '0' ... '9':
-			case ',':
-			case ';':
-				return 0;
-			}
+	fprintf(stderr, "%-32s %10s\n", "Case", "GPU");
+
+	for (i = 0; i < n; i++) {
+		if (!res[i].gpu_ns)
+			continue;
+
+		fprintf(stderr, "%-32s %9.2fx%s\n", res[i].name,
+			(double)(res[i].sim_ns + res[i].render_ns) / res[i].gpu_ns,
+			res[i].gpu_identical ? "" : " different");
+		ret |= !res[i].gpu_identical;
+	}
+
+	return ret;
+}
+
+/* Time the simulation and rendering of each case, printing JSON */
+static int bench_run(const char *baseline)
+{
+	const size_t n = GP_ARRAY_SIZE(bench_cases);
+	struct bench_result res[n];
+	size_t i;
+	int ret = 0;
 
+	for (i = 0; i < n; i++) {
+		if (bench_case_run(&bench_cases[i], &res[i])) {
+			fprintf(stderr, "Benchmark case %zu failed\n", i);
 			return 1;
-		case GP_WIDGET_TBOX_EDIT:
-			parse_rule_nums(gp_widget_tbox_text(ev->self));
-			break;
-		default:
-			break;
 		}
-		break;
-	case GP_WIDGET_CHECKBOX:
-		reversible = gp_widget_bool_get(ev->self);
-		break;
-	default:
-		return 0;
 	}
 
-	pixmap_do_redraw();
+	bench_print(res, n);
 
-	return 0;
+	if (gpu)
+		ret = bench_gpu_compare(res, n);
+
+	if (baseline)
+		ret |= bench_compare(baseline, res, n);
+
+	return ret;
 }
 
-int meta_rule_widget_on_event(gp_widget_event *ev)
+/* Save the grid as an image, streamed when the format allows it */
+static int ca2d_save(const char *path, const float scale)
 {
-	if (ev->type != GP_WIDGET_EVENT_WIDGET)
-		return 0;
+	gp_pixmap *pxm;
+	gp_pixel bg, fg;
+	size_t j;
 
-	const char *text = gp_widget_tbox_text(ev->self);
+	if (!image_writer_open(&image_writer, path, scale)) {
+		for (j = 0; j < height; j++)
+			image_sink.row(&image_sink, steps + gp_matrix_idx(width, j, 0), j);
 
-	switch(ev->self->type) {
-	case GP_WIDGET_TBOX:
-		switch(ev->sub_type) {
-		case GP_WIDGET_TBOX_PRE_FILTER:
-			switch ((char)ev->val) {
-			case '0' ... '9':
-				return 0;
-			}
+		if (!image_writer.finish(&image_writer))
+			return 0;
+	} else if (errno == ENOSYS) {
+		pxm = gp_pixmap_alloc(ca1d_cells() * scale, height * scale, GP_PIXEL_G1);
+		bg = gp_rgb_to_pixmap_pixel(0xff, 0xff, 0xff, pxm);
+		fg = gp_rgb_to_pixmap_pixel(0x00, 0x00, 0x00, pxm);
+
+		render_pixmap(pxm, 1.0f / scale, 1.0f / scale, bg, fg, 1, 0, pxm->h);
+
+		if (!gp_save_image(pxm, path, NULL)) {
+			gp_pixmap_free(pxm);
+			return 0;
+		}
+
+		gp_pixmap_free(pxm);
+	}
+
+	perror("Save Failed!");
+	return 1;
+}
+
+/* Evolve a 2D automaton by gens generations from its seed
+ *
+ * Every generation, the seed included, is written to the raw rows file
+ * and the last one is saved to the image. Without either the GUI shows
+ * the generations which follow.
+ */
+static int ca2d_main(int argc, char *argv[], const char *init_arg,
+		     const char *raw_path, const char *save_path,
+		     const float scale, const uint64_t gens)
+{
+	struct ca1d_sink *sinks = NULL;
+	int ret;
+
+	streaming = 0;
+	if (ca1d_allocate()) {
+		perror("Allocating rows failed");
+		return 1;
+	}
 
+	if (init_arg)
+		init_from_str(init_arg, strlen(init_arg));
+
+	ca2d_seed();
+
+	if (!raw_path && !save_path) {
+		ca2d_evolve(gens, NULL);
+		return widgets_main(argc, argv);
+	}
+
+	if (raw_path) {
+		raw_sink.priv = strcmp(raw_path, "-") ? fopen(raw_path, "wb") : stdout;
+
+		if (!raw_sink.priv) {
+			perror("Opening raw rows file failed");
 			return 1;
-		case GP_WIDGET_TBOX_EDIT:
-			meta_rule = (uint8_t)strtoul(text, NULL, 10);
-			break;
-		default:
-			break;
 		}
-		break;
-	default:
-		return 0;
+
+		sinks = &raw_sink;
 	}
 
-	pixmap_do_redraw();
+	CA1D_STAT_STAMP(sim);
+	ret = (sinks && ca2d_sink_grid(sinks, steps, 0)) || ca2d_evolve(gens, sinks);
+	CA1D_STAT_SINCE(sim_ns, sim);
 
-	return 0;
+	if (raw_path && fclose(raw_sink.priv)) {
+		perror("Closing raw rows file failed");
+		ret = 1;
+	}
+
+	if (save_path && ca2d_save(save_path, scale))
+		ret = 1;
+
+#ifdef CA1D_STATS
+	ca1d_stats_print(stderr);
+#endif
+
+	return ret;
 }
 
-static void init_from_str(const char *text, size_t len)
+/* Answer requests for images or rows from a long running process
+ *
+ * Each request is a line of key=value settings, which start from those
+ * on the command line, and is answered with a line of OK and the size
+ * of the data which follows or with ERR and why not. The data is the
+ * streamed image or the raw rows, as -f and -o write them headless, so
+ * only the rows being worked on are kept and their memory is reused
+ * from one request to the next. Answers are cached by everything they
+ * depend on.
+ *
+ * Requests are answered in turn, as the automaton is global, with each
+ * one's rows shared between the -j threads.
+ */
+#define SERVE_CACHE_BYTES (64UL << 20)
+#define SERVE_CACHE_MAX 256
+/* Connections to the socket served at the same time */
+#define SERVE_CLIENTS 16
+/* Limits on each request */
+#define SERVE_LINE_MAX (1UL << 16)
+#define SERVE_WIDTH_MAX (1UL << 16)
+#define SERVE_BYTES_MAX (1UL << 30)
+/* Segments evolved, as one request holds up all the others */
+#define SERVE_SEGMENTS_MAX (SERVE_BYTES_MAX / 8)
+
+/* Everything an answer depends on besides the initial conditions */
+struct serve_key {
+	struct ca1d_key ca;
+	float scale;
+	/* An image format, or -1 for the raw rows */
+	int format;
+};
+
+struct serve_entry {
+	struct serve_key key;
+	uint64_t *init;
+	char *data;
+	size_t size;
+	uint64_t used;
+};
+
+static struct serve {
+	/* The settings given on the command line */
+	struct ca1d_key defaults;
+	const char *init;
+	float scale;
+	struct serve_entry cache[SERVE_CACHE_MAX];
+	size_t cache_n;
+	size_t cache_bytes;
+	uint64_t clock;
+} serve;
+
+static struct serve_entry *serve_cache_find(const struct serve_key *key)
 {
-	memset(init, 0, width * sizeof(uint64_t));
+	size_t i;
 
-	if (!len)
-		init[width / 2] = 1UL << (63 - (width * 32) % 64);
-	else
-		memcpy(init, text, GP_MIN(width * sizeof(uint64_t), len));
+	for (i = 0; i < serve.cache_n; i++) {
+		struct serve_entry *e = serve.cache + i;
+
+		if (memcmp(&e->key, key, sizeof(*key)) ||
+		    memcmp(e->init, init, width * sizeof(uint64_t)))
+			continue;
+
+		e->used = ++serve.clock;
+		return e;
+	}
+
+	return NULL;
 }
 
-static void init_from_text(void)
+/* Keep an answer, evicting the least recently used ones to make room
+ *
+ * Returns NULL if it is not kept, the caller then still owns data.
+ */
+static struct serve_entry *serve_cache_put(const struct serve_key *key,
+					   char *data, const size_t size)
 {
-	gp_widget *self = gp_widget_by_uid(uids, "init", GP_WIDGET_TBOX);
-	const char *text = gp_widget_tbox_text(self);
-	size_t len = gp_vec_strlen(text);
+	struct serve_entry *e;
+	uint64_t *words;
+	size_t i;
 
-	init_from_str(text, len);
+	if (size > SERVE_CACHE_BYTES / 4)
+		return NULL;
+
+	words = malloc(width * sizeof(uint64_t));
+	if (!words)
+		return NULL;
+
+	while (serve.cache_n == SERVE_CACHE_MAX ||
+	       (serve.cache_n && serve.cache_bytes + size > SERVE_CACHE_BYTES)) {
+		e = serve.cache;
+
+		for (i = 1; i < serve.cache_n; i++) {
+			if (serve.cache[i].used < e->used)
+				e = serve.cache + i;
+		}
+
+		serve.cache_bytes -= e->size;
+		free(e->init);
+		free(e->data);
+		*e = serve.cache[--serve.cache_n];
+	}
+
+	e = serve.cache + serve.cache_n++;
+	memcpy(words, init, width * sizeof(uint64_t));
+	*e = (struct serve_entry) {
+		.key = *key,
+		.init = words,
+		.data = data,
+		.size = size,
+		.used = ++serve.clock,
+	};
+	serve.cache_bytes += size;
+
+	return e;
 }
 
-int width_widget_on_event(gp_widget_event *ev)
+/* Parse a whole decimal number, returns non-zero if val is not one */
+static int serve_number(const char *val, const unsigned long max, unsigned long *n)
 {
-	char c;
+	char *end;
 
-	if (ev->type != GP_WIDGET_EVENT_WIDGET)
-		return 0;
+	if (*val < '0' || *val > '9')
+		return 1;
 
-	const char *text = gp_widget_tbox_text(ev->self);
+	errno = 0;
+	*n = strtoul(val, &end, 10);
 
-	switch(ev->sub_type) {
-	case GP_WIDGET_TBOX_PRE_FILTER:
-		c = (char)ev->val;
+	return *end || errno || *n > max;
+}
 
-		return c < '0' || c > '9';
+/* Apply the settings of a request to the automaton and key
+ *
+ * init takes the rest of the line, so it may have spaces. Returns what
+ * is wrong with the request or NULL.
+ */
+static const char *serve_parse(char *line, struct serve_key *key,
+			       const char **init_str)
+{
+	const struct image_format *fmt;
+	unsigned long n;
+	uint64_t pixels;
+	char *tok, *val, *end;
 
-		break;
-	case GP_WIDGET_TBOX_EDIT:
-		if (!text[0])
-			return 0;
+	for (;;) {
+		tok = line + strspn(line, " \t");
+		if (!*tok)
+			break;
 
-		width = GP_MAX(1, strtol(text, NULL, 10));
-		ca1d_allocate();
-		init_from_text();
-		pixmap_do_redraw();
-		break;
-	default:
-		break;
+		val = strchr(tok, '=');
+		if (!val)
+			return "Expected key=value";
+
+		*val++ = 0;
+
+		if (!strcmp(tok, "init")) {
+			*init_str = val;
+			break;
+		}
+
+		end = val + strcspn(val, " \t");
+		line = *end ? end + 1 : end;
+		*end = 0;
+
+		if (!strcmp(tok, "rule")) {
+			if (parse_rule_nums(val))
+				return "Unknown rule";
+		} else if (!strcmp(tok, "width")) {
+			if (serve_number(val, SERVE_WIDTH_MAX, &n))
+				return "The width must be a number of segments";
+			width = n;
+			tail = 64;
+		} else if (!strcmp(tok, "cells")) {
+			if (serve_number(val, 64 * SERVE_WIDTH_MAX, &n))
+				return "The cells must be a number";
+			ca1d_cells_set(n);
+		} else if (!strcmp(tok, "height")) {
+			if (serve_number(val, SIZE_MAX, &n))
+				return "The height must be a number of steps";
+			height = n;
+		} else if (!strcmp(tok, "boundary")) {
+			if (boundary_parse(val))
+				return "Unknown boundary, expected periodic, zero, one or reflect";
+		} else if (!strcmp(tok, "reversible")) {
+			if (serve_number(val, 1, &n))
+				return "Reversible must be 0 or 1";
+			reversible = n;
+		} else if (!strcmp(tok, "meta")) {
+			if (serve_number(val, 255, &n))
+				return "The meta rule must be a number up to 255";
+			meta_rule = n;
+		} else if (!strcmp(tok, "scale")) {
+			key->scale = strtof(val, &end);
+			if (*end || end == val)
+				return "The scale must be a number";
+		} else if (!strcmp(tok, "format")) {
+			/* The image formats are named by their extensions */
+			val[-1] = '.';
+			fmt = image_format_find(val - 1);
+
+			if (fmt)
+				key->format = fmt - image_formats;
+			else if (!strcmp(val, "raw"))
+				key->format = -1;
+			else
+				return "Unknown format, expected pbm, png or raw";
+		} else {
+			return "Unknown key, expected rule, width, cells, height, boundary, reversible, meta, scale, format or init";
+		}
 	}
 
-	return 0;
+	if (!width || width > SERVE_WIDTH_MAX)
+		return "The width must be from 1 to 65536 segments";
+
+	if (!height)
+		return "The height must be at least one step";
+
+	if (wide_rule.kind != CA1D_RULE_ELEMENTARY && meta_rule)
+		return "Meta rules only choose between elementary rules";
+
+	if (height > SERVE_SEGMENTS_MAX / width)
+		return "Too many steps, the width times the height must be at most 134217728 segments";
+
+	if (key->format < 0)
+		return NULL;
+
+	pixels = (uint64_t)(ca1d_cells() * key->scale) * (uint64_t)(height * key->scale);
+	if (!(key->scale > 0) || ca1d_cells() * key->scale < 1 || height * key->scale < 1 ||
+	    ca1d_cells() * key->scale > UINT32_MAX || height * key->scale > UINT32_MAX ||
+	    pixels / 8 > SERVE_BYTES_MAX)
+		return "The scale must give an image of at least a pixel and at most 8G pixels";
+
+	return NULL;
 }
 
-int height_widget_on_event(gp_widget_event *ev)
+/* Evolve the automaton into the image, or raw rows, in data */
+static int serve_render(const struct serve_key *key, char **data, size_t *size)
 {
-	char c;
+	struct image_writer img;
+	FILE *f = open_memstream(data, size);
+	struct ca1d_sink raw = {
+		.row = raw_sink_row,
+		.priv = f,
+	};
+	struct ca1d_sink sink = {
+		.row = image_sink_row,
+		.priv = &img,
+	};
+	int ret;
 
-	if (ev->type != GP_WIDGET_EVENT_WIDGET)
-		return 0;
+	if (!f)
+		return 1;
 
-	const char *text = gp_widget_tbox_text(ev->self);
+	if (key->format < 0) {
+		ret = ca1d_run(&raw);
+		return fclose(f) || ret;
+	}
 
-	switch(ev->sub_type) {
-	case GP_WIDGET_TBOX_PRE_FILTER:
-		c = (char)ev->val;
+	if (image_writer_start(&img, f, image_formats + key->format, key->scale)) {
+		fclose(f);
+		return 1;
+	}
 
-		return c < '0' || c > '9';
+	ret = ca1d_run(&sink);
 
-		break;
-	case GP_WIDGET_TBOX_EDIT:
-		if (!text[0])
-			return 0;
+	return img.finish(&img) || ret;
+}
 
-		height = GP_MAX(2, strtol(text, NULL, 10));
-		ca1d_allocate();
-		init_from_text();
-		pixmap_do_redraw();
-		break;
-	default:
-		break;
+/* Answer a request, returns non-zero if out can not be written to */
+static int serve_answer(char *line, FILE *out)
+{
+	struct serve_key key;
+	struct serve_entry *e = NULL;
+	const char *init_str = serve.init;
+	const char *err;
+	char *data = NULL;
+	size_t size = 0;
+	int ret;
+
+	memset(&key, 0, sizeof(key));
+	key.scale = serve.scale;
+	/* PNG when built with libpng */
+	key.format = GP_ARRAY_SIZE(image_formats) - 1;
+	ca1d_key_set(&serve.defaults);
+
+	err = serve_parse(line, &key, &init_str);
+	if (err) {
+		ret = fprintf(out, "ERR %s\n", err) < 0;
+		goto out;
+	}
+
+	ca1d_key_get(&key.ca);
+	if (ca1d_allocate()) {
+		ret = fprintf(out, "ERR Allocating the rows failed: %s\n", strerror(errno)) < 0;
+		goto out;
+	}
+
+	if (init_str)
+		init_from_str(init_str, strlen(init_str));
+
+	e = serve_cache_find(&key);
+	if (e) {
+		data = e->data;
+		size = e->size;
+	} else if ((errno = 0, serve_render(&key, &data, &size))) {
+		ret = fprintf(out, "ERR %s\n", errno ? strerror(errno) : "Evolving failed") < 0;
+		goto out;
+	} else if ((e = serve_cache_put(&key, data, size))) {
+		data = e->data;
+	}
+
+	ret = fprintf(out, "OK %zu\n", size) < 0 || fwrite(data, 1, size, out) != size;
+out:
+	if (!e)
+		free(data);
+
+	return fflush(out) || ret;
+}
+
+/* Answer each line of in on out until in ends */
+static int serve_stream(FILE *in, FILE *out)
+{
+	char *line = NULL;
+	size_t len = 0;
+	ssize_t n;
+	int ret = 0;
+
+	while (!ret && (n = getline(&line, &len, in)) > 0) {
+		line[strcspn(line, "\r\n")] = 0;
+		ret = serve_answer(line, out);
+	}
+
+	free(line);
+
+	return ret;
+}
+
+/* A connection to the socket, the part of a request it has sent and
+ * the answers it has not read yet
+ *
+ * The socket is non-blocking and a client is not read from until it has
+ * taken all of its answers, so one which stops reading only holds up
+ * itself.
+ */
+struct serve_client {
+	int fd;
+	char *buf;
+	size_t len;
+	char *out;
+	size_t out_len, out_off;
+	/* Close the connection once the answers are sent */
+	int closing;
+};
+
+static void serve_client_close(struct serve_client *self)
+{
+	close(self->fd);
+	free(self->buf);
+	free(self->out);
+	self->fd = -1;
+	self->out = NULL;
+}
+
+/* Send as much of the answers as the socket takes
+ *
+ * Returns non-zero once the connection should be closed.
+ */
+static int serve_client_write(struct serve_client *self)
+{
+	ssize_t n;
+
+	while (self->out_off < self->out_len) {
+		n = write(self->fd, self->out + self->out_off, self->out_len - self->out_off);
+		if (n < 0)
+			return errno != EAGAIN && errno != EINTR;
+
+		self->out_off += n;
 	}
 
-	return 0;
+	free(self->out);
+	self->out = NULL;
+	self->out_len = self->out_off = 0;
+
+	return self->closing;
 }
 
-int init_widget_on_event(gp_widget_event *ev)
+/* Read what the client sent, answering each whole line of it
+ *
+ * Returns non-zero once the connection should be closed.
+ */
+static int serve_client_read(struct serve_client *self)
 {
+	char *nl, *line;
+	ssize_t n;
+	FILE *out;
+	int ret = 0;
 
-	if (ev->type != GP_WIDGET_EVENT_WIDGET)
+	n = read(self->fd, self->buf + self->len, SERVE_LINE_MAX - self->len);
+	if (n < 0 && (errno == EAGAIN || errno == EINTR))
 		return 0;
+	if (n <= 0)
+		return 1;
 
-	switch(ev->sub_type) {
-	case GP_WIDGET_TBOX_EDIT:
-		init_from_text();
-		pixmap_do_redraw();
-		break;
-	default:
-		break;
+	self->len += n;
+
+	out = open_memstream(&self->out, &self->out_len);
+	if (!out)
+		return 1;
+
+	while (!ret && (nl = memchr(self->buf, '\n', self->len))) {
+		*nl = 0;
+		line = self->buf;
+		line[strcspn(line, "\r")] = 0;
+
+		ret = serve_answer(line, out);
+
+		self->len -= nl + 1 - self->buf;
+		memmove(self->buf, nl + 1, self->len);
 	}
 
-	return 0;
+	if (!ret && self->len == SERVE_LINE_MAX) {
+		fprintf(out, "ERR The request is longer than %lu bytes\n", SERVE_LINE_MAX);
+		self->closing = 1;
+	}
+
+	if (fclose(out) || ret)
+		return 1;
+
+	return serve_client_write(self);
 }
 
-int save_on_event(gp_widget_event *ev)
+/* Listen on a Unix socket at path and answer clients until killed
+ *
+ * The clients are polled, so any of them can send the next request.
+ */
+static int serve_socket(const char *path)
 {
-	const char *path;
-	gp_dialog *dialog;
-	gp_widget *pixmap_w;
-	gp_pixmap *pixmap;
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct serve_client clients[SERVE_CLIENTS];
+	struct pollfd fds[SERVE_CLIENTS + 1];
+	struct stat st;
+	size_t i, n;
+	int fd, lfd;
 
-	if (ev->type != GP_WIDGET_EVENT_WIDGET)
-		return 0;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return 1;
+	}
 
-	dialog = gp_dialog_file_save_new(NULL, NULL);
+	strcpy(addr.sun_path, path);
 
-	if (gp_dialog_run(dialog) != GP_WIDGET_DIALOG_PATH)
-		return 0;
+	for (i = 0; i < SERVE_CLIENTS; i++)
+		clients[i] = (struct serve_client){ .fd = -1 };
 
-	pixmap_w = gp_widget_by_uid(uids, "pixmap", GP_WIDGET_PIXMAP);
-	pixmap = gp_widget_pixmap_get(pixmap_w);
+	lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (lfd < 0)
+		return 1;
 
-	path = gp_dialog_file_path(dialog);
+	/* Replace the socket of an earlier server, but nothing else */
+	if (!stat(path, &st) && S_ISSOCK(st.st_mode))
+		unlink(path);
 
-	if (gp_save_image(pixmap, path, NULL))
-		gp_dialog_msg_printf_run(GP_DIALOG_MSG_ERR, "Save Failed", "%s", strerror(errno));
+	if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) || listen(lfd, SERVE_CLIENTS)) {
+		close(lfd);
+		return 1;
+	}
 
-	gp_dialog_free(dialog);
+	/* A client going away is only an error for its connection */
+	signal(SIGPIPE, SIG_IGN);
 
-	return 0;
+	for (;;) {
+		fds[0] = (struct pollfd){ .fd = lfd, .events = POLLIN };
+
+		for (i = 0; i < SERVE_CLIENTS; i++) {
+			fds[i + 1] = (struct pollfd) {
+				.fd = clients[i].fd,
+				.events = clients[i].out ? POLLOUT : POLLIN,
+			};
+		}
+
+		if (poll(fds, SERVE_CLIENTS + 1, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		for (i = 0; i < SERVE_CLIENTS; i++) {
+			if (!fds[i + 1].revents)
+				continue;
+
+			if (clients[i].out ? serve_client_write(clients + i) :
+			    serve_client_read(clients + i))
+				serve_client_close(clients + i);
+		}
+
+		if (!(fds[0].revents & POLLIN))
+			continue;
+
+		fd = accept(lfd, NULL, NULL);
+		if (fd < 0)
+			continue;
+
+		for (n = 0; n < SERVE_CLIENTS && clients[n].fd >= 0; n++)
+			;
+
+		if (n == SERVE_CLIENTS || fcntl(fd, F_SETFL, O_NONBLOCK)) {
+			close(fd);
+			continue;
+		}
+
+		clients[n] = (struct serve_client) {
+			.fd = fd,
+			.buf = malloc(SERVE_LINE_MAX),
+		};
+
+		if (!clients[n].buf)
+			serve_client_close(clients + n);
+	}
+
+	close(lfd);
+	return 1;
 }
 
-int widgets_main(int argc, char *argv[])
+/* Serve requests on stdin, or the socket at path */
+static int serve_run(const char *path, const char *init_arg, const float scale)
 {
-	gp_widget *layout = gp_app_layout_load("automata", &uids);
+	ca1d_key_get(&serve.defaults);
+	serve.init = init_arg;
+	serve.scale = scale;
+	streaming = 1;
 
-	if (!layout)
-		return 0;
+	if (!strcmp(path, "-"))
+		return serve_stream(stdin, stdout);
 
-	gp_widget *pixmap = gp_widget_by_uid(uids, "pixmap", GP_WIDGET_PIXMAP);
+	if (serve_socket(path)) {
+		perror("Serving on the socket failed");
+		return 1;
+	}
 
-	gp_widget_events_unmask(pixmap, GP_WIDGET_EVENT_RESIZE);
-	gp_widgets_main_loop(layout, NULL, argc, argv);
+	return 0;
 }
 
 gp_app_info app_info = {
@@ -565,15 +8335,52 @@ int main(int argc, char *argv[])
 	int c;
 	const char *init_arg = NULL;
 	const char *save_path = NULL;
+	const char *raw_path = NULL;
+	const char *run_path = NULL;
+	const char *load_path = NULL;
+	const char *checkpoint_path = NULL;
+	const char *rewind_path = NULL;
+	const char *isa = NULL;
+	const char *sweep_rules = NULL;
+	const char *sweep_metas = NULL;
+	const char *serve_path = NULL;
+	struct sweep sweep = { .dir = NULL };
+	struct ensemble ensemble = { .density = 0.5, .seed = 1 };
+	struct ca1d_sink *sinks = NULL;
+	struct run_file run = { .map = NULL };
+	struct checkpoint_header resume_from;
+	FILE *resume_f = NULL;
+	struct checkpoint_header rewind_from;
+	FILE *rewind_f = NULL;
+	unsigned int period = CHECKPOINT_SECS;
+	size_t max_height = SIZE_MAX;
+	uint64_t generation = 0;
 	float scale = 1;
+	int stats = 0;
+	int cycle = 0;
+	int resume = 0;
+	int bench = 0;
+	int image = 0;
+	int ret = 0;
 
-	while ((c = getopt(argc, argv, "+w:h:i:m:f:r:es:")) != -1) {
+	while ((c = getopt(argc, argv, "+w:n:E:h:i:m:f:r:es:k:j:t:o:SCR:M:d:Bg:a:l:c:p:ubL:x:N:D:Z:GP:")) != -1) {
 		switch(c) {
 		case 'w':
 			width = strtoul(optarg, NULL, 10);
+			tail = 64;
+			break;
+		case 'n':
+			ca1d_cells_set(strtoul(optarg, NULL, 10));
+			break;
+		case 'E':
+			if (boundary_parse(optarg)) {
+				fprintf(stderr, "Unknown boundary '%s', expected periodic, zero, one or reflect\n",
+					optarg);
+				return 1;
+			}
 			break;
 		case 'h':
-			height = strtoul(optarg, NULL, 10);
+			height = max_height = strtoul(optarg, NULL, 10);
 			break;
 		case 'i':
 			init_arg = optarg;
@@ -585,7 +8392,10 @@ int main(int argc, char *argv[])
 			save_path = optarg;
 			break;
 		case 'r':
-			parse_rule_nums(optarg);
+			if (parse_rule_nums(optarg)) {
+				fprintf(stderr, "Invalid rule '%s', expected e.g. 30,45 or t2:44\n", optarg);
+				return 1;
+			}
 			break;
 		case 'e':
 			reversible = 1;
@@ -593,37 +8403,437 @@ int main(int argc, char *argv[])
 		case 's':
 			scale = strtof(optarg, NULL);
 			break;
+		case 'k':
+			isa = optarg;
+			break;
+		case 'j':
+			threads = strtoul(optarg, NULL, 10);
+			if (!threads)
+				threads = sysconf(_SC_NPROCESSORS_ONLN);
+			break;
+		case 't':
+			tile_steps = strtoul(optarg, NULL, 10);
+			break;
+		case 'o':
+			raw_path = optarg;
+			break;
+		case 'S':
+			stats = 1;
+			break;
+		case 'C':
+			cycle = 1;
+			break;
+		case 'R':
+			sweep_rules = optarg;
+			break;
+		case 'M':
+			sweep_metas = optarg;
+			break;
+		case 'd':
+			sweep.dir = optarg;
+			break;
+		case 'B':
+			sweep.sliced = 1;
+			break;
+		case 'g':
+			generation = strtoull(optarg, NULL, 10);
+			break;
+		case 'a':
+			run_path = optarg;
+			break;
+		case 'l':
+			load_path = optarg;
+			break;
+		case 'c':
+			checkpoint_path = optarg;
+			break;
+		case 'p':
+			period = strtoul(optarg, NULL, 10);
+			break;
+		case 'u':
+			resume = 1;
+			break;
+		case 'b':
+			bench = 1;
+			break;
+		case 'L':
+			if (ca2d_rule_parse(optarg, &ca2d_bs)) {
+				fprintf(stderr, "Invalid 2D rule '%s', expected e.g. B3/S23\n", optarg);
+				return 1;
+			}
+			ca2d = 1;
+			break;
+		case 'x':
+			rewind_path = optarg;
+			break;
+		case 'N':
+			ensemble.runs = strtoull(optarg, NULL, 10);
+			break;
+		case 'D':
+			ensemble.density = GP_MIN(1.0f, GP_MAX(0.0f, strtof(optarg, NULL)));
+			break;
+		case 'Z':
+			ensemble.seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'G':
+#ifdef HAVE_GLES
+			gpu = 1;
+			break;
+#else
+			fprintf(stderr, "Built without the GPU backend, build with make GPU=1\n");
+			return 1;
+#endif
+		case 'P':
+			serve_path = optarg;
+			break;
 		default:
 			fprintf(stderr,
-				"Usage:\n\t%s [-w <width>][-h <height>][-i <initial conditions>][-f <save file>][-r <rule>][-m <meta_rule>][-e][-s <scale>]\n",
+				"Usage:\n\t%s [-w <width>][-n <cells>][-E <periodic|zero|one|reflect>][-h <height>][-i <initial conditions>][-f <save file>][-r <rule>][-m <meta_rule>][-e][-s <scale>][-k <avx512|avx2|v128|scalar>][-j <threads>][-t <tile steps>][-o <raw rows file>][-S][-C][-R <rules>][-M <meta rules>][-d <directory>][-B][-g <generation>][-a <run file>][-l <run file>][-c <checkpoint file>][-p <seconds>][-u][-b [<baseline>]][-L <B/S rule>][-x <checkpoint file>][-N <runs>][-D <density>][-Z <seed>][-G][-P <socket path>]\n",
 				argv[0]);
 			return 1;
 		}
 	}
 
-	ca1d_allocate();
+	if (ca1d_isa_select(isa)) {
+		fprintf(stderr, "Row kernel '%s' is not supported\n", isa);
+		return 1;
+	}
+
+	if (bench)
+		return bench_run(optind < argc ? argv[optind] : NULL);
+
+	if (wide_rule.kind != CA1D_RULE_ELEMENTARY && meta_rule) {
+		fprintf(stderr, "Meta rules only choose between elementary rules\n");
+		return 1;
+	}
+
+	if ((sweep.dir || sweep.sliced) && !sweep_rules && !sweep_metas) {
+		fprintf(stderr, "-d and -B only apply to the -R and -M sweeps\n");
+		return 1;
+	}
+
+	if (serve_path) {
+		if (save_path || raw_path || run_path || load_path || checkpoint_path ||
+		    rewind_path || resume || stats || cycle || sweep_rules || sweep_metas ||
+		    ensemble.runs || generation || gpu || ca2d) {
+			fprintf(stderr, "Serving only takes the settings of the automaton and image\n");
+			return 1;
+		}
+
+		return serve_run(serve_path, init_arg, scale);
+	}
+
+	if (gpu && (!save_path || raw_path || run_path || stats || cycle || checkpoint_path ||
+		    resume || load_path || sweep_rules || sweep_metas || ensemble.runs || ca2d)) {
+		fprintf(stderr, "The GPU only renders the -f image of a 1D automaton\n");
+		return 1;
+	}
+
+	if (ca2d) {
+		if (sweep_rules || sweep_metas || load_path || run_path || checkpoint_path ||
+		    rewind_path || ensemble.runs || resume || cycle || stats || reversible || meta_rule ||
+		    wide_rule.kind != CA1D_RULE_ELEMENTARY) {
+			fprintf(stderr, "2D automata only have the -o and -f outputs and no 1D rules\n");
+			return 1;
+		}
+
+		return ca2d_main(argc, argv, init_arg, raw_path, save_path, scale, generation);
+	}
+
+	if (ensemble.runs) {
+		if (sweep_rules || sweep_metas || save_path || raw_path || run_path ||
+		    load_path || checkpoint_path || rewind_path || resume || stats || cycle) {
+			fprintf(stderr, "Ensembles only print their statistics and use the -r rules\n");
+			return 1;
+		}
+
+		streaming = 1;
+		if (ca1d_allocate()) {
+			perror("Allocating rows failed");
+			return 1;
+		}
+
+		return ensemble_run(&ensemble);
+	}
+
+	if (sweep_rules || sweep_metas) {
+		/* Sweeps go through the elementary rules */
+		wide_rule.kind = CA1D_RULE_ELEMENTARY;
+
+		if ((sweep_rules && sweep_parse(&sweep, sweep_rules, 0)) ||
+		    (sweep_metas && sweep_parse(&sweep, sweep_metas, 1)) ||
+		    !sweep.n) {
+			fprintf(stderr, "Invalid rule list, expected e.g. 0-255,30r\n");
+			return 1;
+		}
+
+		streaming = 1;
+		if (ca1d_allocate()) {
+			perror("Allocating rows failed");
+			return 1;
+		}
+
+		if (init_arg)
+			init_from_str(init_arg, strlen(init_arg));
+
+		return sweep_run(&sweep, save_path, scale);
+	}
+
+	if (resume) {
+		if (!checkpoint_path) {
+			fprintf(stderr, "Resuming needs the checkpoint file given with -c\n");
+			return 1;
+		}
+
+		if (save_path || run_path || load_path || cycle) {
+			fprintf(stderr, "Only the -o and -S outputs can be resumed\n");
+			return 1;
+		}
+
+		/* Without a checkpoint yet the run starts from the beginning */
+		resume_f = checkpoint_open(checkpoint_path, &resume_from);
+		if (!resume_f && errno != ENOENT) {
+			perror("Reading checkpoint failed");
+			return 1;
+		}
+
+		if (resume_f) {
+			checkpoint.from = resume_from.step;
+			fprintf(stderr, "Resuming after step %zu\n", checkpoint.from);
+		}
+	}
+
+	if (rewind_path) {
+		if (resume || load_path) {
+			fprintf(stderr, "Regenerating steps from a checkpoint can not be combined with -u or -l\n");
+			return 1;
+		}
+
+		rewind_f = checkpoint_open(rewind_path, &rewind_from);
+		if (!rewind_f) {
+			perror("Reading checkpoint failed");
+			return 1;
+		}
+
+		/* The rest of the run from the generation unless -h is given */
+		if (max_height != SIZE_MAX) {
+			height = max_height;
+		} else if (generation < rewind_from.height) {
+			height = rewind_from.height - generation;
+		} else {
+			fprintf(stderr, "The run only has %zu steps\n", (size_t)rewind_from.height);
+			return 1;
+		}
+	}
+
+	if (load_path) {
+		if (run_file_open(&run, load_path)) {
+			perror("Loading run failed");
+			return 1;
+		}
+
+		if (run_file_apply(&run, generation, max_height)) {
+			fprintf(stderr, "The run only has %zu steps\n", (size_t)run.h.height);
+			return 1;
+		}
+	}
+
+	if (raw_path) {
+		raw_sink.priv = strcmp(raw_path, "-") ?
+			fopen(raw_path, resume_f ? "r+b" : "wb") : stdout;
+
+		if (!raw_sink.priv) {
+			perror("Opening raw rows file failed");
+			return 1;
+		}
+
+		/* Drop the rows written after the checkpoint */
+		if (resume_f && raw_sink.priv != stdout &&
+		    (ftruncate(fileno(raw_sink.priv), resume_from.raw_bytes) ||
+		     fseeko(raw_sink.priv, 0, SEEK_END) ||
+		     (uint64_t)ftello(raw_sink.priv) != resume_from.raw_bytes)) {
+			fprintf(stderr, "The raw rows file does not match the checkpoint\n");
+			return 1;
+		}
+
+		raw_sink.next = sinks;
+		sinks = &raw_sink;
+	}
+
+	if (stats) {
+		stats_sink.next = sinks;
+		sinks = &stats_sink;
+
+		if (resume_f) {
+			row_stats = (struct row_stats) {
+				.rows = resume_from.rows,
+				.pop_min = resume_from.pop_min,
+				.pop_max = resume_from.pop_max,
+				.pop_sum = resume_from.pop_sum,
+				.pop_last = resume_from.pop_last,
+			};
+		}
+	}
+
+	if (run_path) {
+		run_sink.next = sinks;
+		sinks = &run_sink;
+	}
+
+	if (save_path && !gpu && !image_writer_open(&image_writer, save_path, scale)) {
+		image_sink.next = sinks;
+		sinks = &image_sink;
+		image = 1;
+		save_path = NULL;
+	} else if (save_path && !gpu && errno != ENOSYS) {
+		perror("Save Failed!");
+		return 1;
+	}
+
+	/* Without a pixmap only the rows being worked on are needed */
+	streaming = gpu || (!save_path && (sinks || cycle || checkpoint_path));
+
+	if (ca1d_allocate()) {
+		perror("Allocating rows failed");
+		return 1;
+	}
 
 	if (init_arg)
 		init_from_str(init_arg, strlen(init_arg));
 
-	if (!save_path)
+	if (load_path && run_file_init(&run, generation)) {
+		fprintf(stderr, "Reading the run's initial conditions failed\n");
+		return 1;
+	}
+
+	if (resume_f && checkpoint_rows(resume_f)) {
+		perror("Reading checkpoint failed");
+		return 1;
+	}
+
+	if (rewind_f) {
+		if (checkpoint_rows(rewind_f)) {
+			perror("Reading checkpoint failed");
+			return 1;
+		}
+
+		if (ca1d_pair_step(init_prev, init, generation - rewind_from.step)) {
+			if (errno == EINVAL)
+				fprintf(stderr, "Only reversible runs can be stepped back before step %zu\n",
+					(size_t)rewind_from.step);
+			else
+				perror("Stepping the checkpoint failed");
+			return 1;
+		}
+	}
+
+	if (generation && !load_path && !resume_f && !rewind_f && ca1d_hl_advance(generation)) {
+		if (rule_n != 1 || meta_rule || wide_rule.kind != CA1D_RULE_ELEMENTARY)
+			fprintf(stderr, "Jumping ahead needs a single elementary rule and no meta rule\n");
+		else if (tail != 64 || boundary != CA1D_BOUNDARY_PERIODIC)
+			fprintf(stderr, "Jumping ahead needs whole segments and a periodic boundary\n");
+		else
+			perror("Jumping ahead failed");
+		return 1;
+	}
+
+	if (run_path && run_writer_open(&run_writer, run_path)) {
+		perror("Opening run file failed");
+		return 1;
+	}
+
+	if (checkpoint_path) {
+		checkpoint.path = checkpoint_path;
+		checkpoint.period = period;
+
+		if (checkpoint_init(&checkpoint, sinks, raw_path ? raw_sink.priv : NULL,
+				    stats ? &row_stats : NULL)) {
+			perror("Allocating checkpoint failed");
+			return 1;
+		}
+
+		sinks = &checkpoint_sink;
+	}
+
+	if (cycle) {
+		if (cycle_sink_init(&cycle_state, sinks)) {
+			perror("Allocating cycle detector failed");
+			return 1;
+		}
+
+		sinks = &cycle_sink;
+	}
+
+	if (!save_path && !sinks) {
+		if (load_path && run_file_load(&run, generation, NULL))
+			return 1;
+
+		run_file_close(&run);
+
 		return widgets_main(argc, argv);
+	}
+
+	if (sinks) {
+		CA1D_STAT_STAMP(sim);
+
+		ret = load_path ? run_file_load(&run, generation, sinks) : ca1d_run(sinks);
+		CA1D_STAT_SINCE(sim_ns, sim);
+	}
+
+	if (cycle) {
+		if (cycle_state.stopped && !cycle_state.failed)
+			ret = cycle_replay(&cycle_state);
+
+		cycle_print(&cycle_state);
+	}
+
+	if (image) {
+		if (image_writer.finish(&image_writer)) {
+			perror("Save Failed!");
+			ret = 1;
+		}
+	}
+
+	if (run_path && run_writer_finish(&run_writer)) {
+		perror("Saving run failed");
+		ret = 1;
+	}
+
+	if (raw_path && fclose(raw_sink.priv)) {
+		perror("Closing raw rows file failed");
+		ret = 1;
+	}
+
+	if (stats)
+		stats_print(&row_stats);
+
+#ifdef CA1D_STATS
+	ca1d_stats_print(stderr);
+#endif
 
-	gp_pixmap *pxm = gp_pixmap_alloc(width * 64 * scale, height * scale, GP_PIXEL_G1);
+	if (!save_path)
+		return ret;
+
+#ifdef HAVE_GLES
+	if (gpu)
+		return gpu_save(save_path, scale);
+#endif
+
+	gp_pixmap *pxm = gp_pixmap_alloc(ca1d_cells() * scale, height * scale, GP_PIXEL_G1);
 	gp_pixel bg = gp_rgb_to_pixmap_pixel(0xff, 0xff, 0xff, pxm);
 	gp_pixel fg = gp_rgb_to_pixmap_pixel(0x00, 0x00, 0x00, pxm);
 
-	ca1d_run();
+	if (!sinks && (load_path ? run_file_load(&run, generation, NULL) : ca1d_run(NULL)))
+		return 1;
+
+	run_file_close(&run);
 
-	for (uint32_t y = 0; y < height * scale; y++) {
-		for (uint32_t x = 0; x < width * 64 * scale; x++)
-			shade_pixel(pxm, 1.0f / scale, 1.0f / scale, x, y, bg, fg);
-	}
+	render_pixmap(pxm, 1.0f / scale, 1.0f / scale, bg, fg, 1, 0, pxm->h);
 
 	if (gp_save_image(pxm, save_path, NULL)) {
 		perror("Save Failed!");
 		return 1;
 	}
 
-	return 0;
+	return ret;
 }
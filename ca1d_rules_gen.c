@@ -0,0 +1,132 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Copyright (C) 2021 Richard Palethorpe (richiejp.com)
+ */
+
+/* Generates ca1d_rules.gen.h which maps each of the 256 elementary rules
+ * to a minimal bitwise expression over the left, center and right
+ * neighbour bitfields.
+ *
+ * Each boolean function of three variables is represented by its 8bit
+ * truth table, which is exactly the Wolfram rule number when bit 2 of
+ * the table index is the left cell, bit 1 the center and bit 0 the
+ * right. The expressions are found by enumerating all formulas built
+ * from ~, &, | and ^ in order of increasing operator count; the first
+ * formula to reach a truth table is kept.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define EXPR_MAX 128
+
+static int cost[256];
+static int binary[256];
+static char expr[256][EXPR_MAX];
+
+/* Wrap an expression in parentheses unless it is atomic */
+static void operand(char *buf, const uint8_t f)
+{
+	if (!binary[f]) {
+		strcpy(buf, expr[f]);
+		return;
+	}
+
+	buf[0] = '(';
+	strcpy(buf + 1, expr[f]);
+	strcat(buf, ")");
+}
+
+static int found;
+
+static void add(const uint8_t f, const int c, const int bin, const char *e)
+{
+	if (cost[f] >= 0 || strlen(e) >= EXPR_MAX)
+		return;
+
+	cost[f] = c;
+	binary[f] = bin;
+	strcpy(expr[f], e);
+	found++;
+}
+
+static void gen_level(const int c)
+{
+	static const char ops[] = { '^', '&', '|' };
+	char a[EXPR_MAX + 2], b[EXPR_MAX + 2], e[2 * EXPR_MAX + 8];
+	int f, g, o;
+
+	for (f = 0; f < 256; f++) {
+		if (cost[f] != c - 1)
+			continue;
+
+		operand(a, f);
+		sprintf(e, "~%s", a);
+		add(~f & 0xff, c, 0, e);
+	}
+
+	for (f = 0; f < 256; f++) {
+		if (cost[f] < 0 || cost[f] > c - 1)
+			continue;
+
+		/* The neighbours' truth tables are ordered r < c < l, so
+		 * printing the larger table first gives l, c, r order.
+		 */
+		for (g = f; g < 256; g++) {
+			if (cost[g] < 0 || cost[f] + cost[g] != c - 1)
+				continue;
+
+			operand(a, f);
+			operand(b, g);
+
+			for (o = 0; o < 3; o++) {
+				uint8_t h;
+
+				switch (ops[o]) {
+				case '^':
+					h = f ^ g;
+					break;
+				case '&':
+					h = f & g;
+					break;
+				default:
+					h = f | g;
+				}
+
+				sprintf(e, "%s %c %s", b, ops[o], a);
+				add(h, c, 1, e);
+			}
+		}
+	}
+}
+
+int main(void)
+{
+	int c, i;
+
+	memset(cost, -1, sizeof(cost));
+
+	/* The truth tables of the neighbours are the rules which copy them */
+	add(0xf0, 0, 0, "l");
+	add(0xcc, 0, 0, "c");
+	add(0xaa, 0, 0, "r");
+	add(0x00, 0, 0, "0");
+	add(0xff, 0, 0, "~(uint64_t)0");
+
+	for (c = 1; found < 256; c++)
+		gen_level(c);
+
+	printf("/* Generated by ca1d_rules_gen, do not edit */\n\n");
+	printf("#ifndef CA1D_RULES_GEN_H\n#define CA1D_RULES_GEN_H\n\n");
+	printf("/* X(rule number, operator count, expression over l, c and r) */\n");
+	printf("#define CA1D_RULES(X) \\\n");
+
+	for (i = 0; i < 256; i++)
+		printf("\tX(%d, %d, %s)%s\n", i, cost[i], expr[i], i < 255 ? " \\" : "");
+
+	printf("\n#endif /* CA1D_RULES_GEN_H */\n");
+
+	return 0;
+}